@@ -20,9 +20,15 @@
 
 #include "src/config.h"
 #include "src/globals.h"
+#include "src/history_store.h"
 #include "src/ble_handler.h"
+#include "src/ble_ota.h"
+#include "src/ble_notify.h"
+#include "src/ble_events.h"
+#include "src/ble_link.h"
 #include "src/display.h"
 #include "src/hardware.h"
+#include "src/heap_monitor.h"
 #include "src/input.h"
 #include "src/storage.h"
 #include "src/wifi_ota.h"
@@ -51,10 +57,11 @@ BLECharacteristic *pDataEventCharacteristic = NULL;
 
 // ---- 儲存 ----
 Preferences preferences;
-File historyFile;
 
 // ---- 狀態與數據 ----
 WiFiState wifiState = WIFI_IDLE;
+String wifiSSID;     // NVS "wifi" 命名空間的 RAM 副本 (loadPersistentStates 載入)
+String wifiPassword;
 unsigned long wifiConnectionStartTime = 0;
 UIMode currentUIMode = UI_MODE_MAIN_SCREENS;
 SystemMenuItem selectedMenuItem = MENU_ITEM_WIFI;
@@ -68,6 +75,13 @@ DataPoint historyWindowBuffer[HISTORY_WINDOW_SIZE];
 int historyIndex = 0;
 int historyCount = 0;
 int historyViewOffset = 0;
+RollupBucket rollupWindowBuffer[HISTORY_WINDOW_SIZE];
+ChartColumn chartColumnBuffer[CHART_COLUMNS];
+ChartResolution chartResolution = CHART_RAW;
+HistoryWriteStats historyWriteStats;
+BleLinkStats bleLinkStats;
+DisplayStats displayStats;
+HeapStats heapStats;
 bool bleDeviceConnected = false;
 bool isEngineeringMode = false;
 bool isOtaMode = false; // Wi-Fi OTA
@@ -75,9 +89,6 @@ bool isBleOtaInProgress = false; // <--- 新增
 unsigned long otaStartTime = 0; // <--- 新增
 size_t otaTotalSize = 0; // <--- 新增
 size_t otaBytesReceived = 0; // <--- 新增
-bool isSendingHistoricData = false;
-int historicDataIndexToSend = 0;
-unsigned long historicDataStartTime = 0;
 unsigned long lastDisplayUpdate = 0;
 const unsigned long displayInterval = 100;
 unsigned long lastHistoryRecord = 0;
@@ -93,9 +104,6 @@ const unsigned long NTP_RESYNC_INTERVAL = 12 * 3600000;
 unsigned long lastWeatherUpdate = 0;
 const unsigned long WEATHER_INTERVAL = 600000;
 unsigned long lastBackPressTime = 0;
-bool isRealtimeEnabled = false;
-unsigned long lastRealtimeSend = 0;
-const unsigned long REALTIME_INTERVAL = 2000;
 float cachedTemp = 0.0;
 float cachedHum = 0.0;
 bool sensorDataValid = false;
@@ -105,6 +113,7 @@ uint8_t alarmHour = 0;
 uint8_t alarmMinute = 0;
 bool alarmEnabled = false;
 bool isAlarmRinging = false;
+uint8_t slotStatusMask = 0b00001111; // 回報給 App 的藥格狀態 (0x80)
 unsigned long lastAlarmCheckTime = 0;
 
 
@@ -127,16 +136,29 @@ void setup() {
     Wire.begin(I2C_SDA_PIN, I2C_SCL_PIN);
     u8g2.begin();
     u8g2.enableUTF8Print();
+    setupDisplay(); // 之後的 I2C 傳送都在 display task 中進行
     Serial.println("DEBUG: Initializing DHT sensor.");
     dht.begin();
     runPOST();
-    if (!SPIFFS.begin(true)) {
-        Serial.println("SPIFFS mount failed");
+    if (!DATA_FS.begin(true)) {
+        Serial.println(DATA_FS_NAME " mount failed");
     }
-    Serial.println("DEBUG: SPIFFS mounted.");
+    Serial.println("DEBUG: " DATA_FS_NAME " mounted.");
+#ifdef HISTORY_STORE_BENCHMARK
+    runHistoryStoreBenchmark();
+#endif
+    unsigned long bootStepStart = micros();
     initializeHistoryFile();
+    initializeRollupFiles();
+    unsigned long bootInitHistoryUs = micros() - bootStepStart;
+    bootStepStart = micros();
     loadHistoryMetadata();
+    unsigned long bootLoadMetaUs = micros() - bootStepStart;
+    bootStepStart = micros();
     loadPersistentStates();
+    unsigned long bootLoadStatesUs = micros() - bootStepStart;
+    Serial.printf("DEBUG: Boot timing - initializeHistoryFile %.1f ms, loadHistoryMetadata %.1f ms, loadPersistentStates %.1f ms\n",
+                  bootInitHistoryUs / 1000.0, bootLoadMetaUs / 1000.0, bootLoadStatesUs / 1000.0);
     rotaryEncoder.begin();
     rotaryEncoder.setup([] { rotaryEncoder.readEncoder_ISR(); }, [] {});
     Serial.println("DEBUG: Rotary encoder initialized.");
@@ -145,7 +167,7 @@ void setup() {
     u8g2.drawStr((128 - u8g2.getStrWidth("SmartMedBox"))/2, 30, "SmartMedBox");
     u8g2.setFont(u8g2_font_ncenB08_tr);
     u8g2.drawStr((128 - u8g2.getStrWidth(FIRMWARE_VERSION))/2, 45, FIRMWARE_VERSION);
-    u8g2.sendBuffer();
+    sendDisplayFrame();
     delay(2000);
     setupBLE();
     WiFi.persistent(false);
@@ -155,19 +177,20 @@ void setup() {
     currentPageIndex = SCREEN_TIME;
     updateScreens();
     rotaryEncoder.setEncoderValue(currentPageIndex);
+    setupHeapMonitor(); // 之後進入穩定狀態，loop 不應再配置記憶體
     Serial.println("--- Setup Complete ---\n");
 }
 
 void loop() {
-    if (isBleOtaInProgress) { // 如果正在進行 BLE OTA，則不執行其他操作
-        // BLE 的指令處理是中斷驅動的，所以這裡不需要做任何事
-        // 可以加上超時邏輯
-        if (millis() - otaStartTime > 60000) { // 60 秒超時
-            Serial.println("ERROR: BLE OTA timed out!");
-            isBleOtaInProgress = false;
-        }
-        return;
-    }
+    handleBleCommands(); // BLE 寫入在 callback 中只排入佇列，統一在這裡處理
+    handleStateEvents();
+    handleNotifyQueue();
+    handleLinkProfiles();
+
+    // BLE OTA 資料已由上方的 handleBleCommands() 寫入，這裡只檢查逾時 (見 ble_ota.cpp)。
+    // 接收中 (所屬連線在線且持續送資料) 畫面顯示進度，跳過畫面、按鍵與阻塞的網路請求；鬧鐘、感測器與歷史紀錄照常執行
+    handleOtaTimeout();
+    bool otaReceiving = isBleOtaReceiving();
 
     if (isOtaMode) {
         ArduinoOTA.handle();
@@ -178,7 +201,7 @@ void loop() {
             u8g2.clearBuffer();
             u8g2.setFont(u8g2_font_ncenB10_tr);
             u8g2.drawStr((128-u8g2.getStrWidth("Rebooting..."))/2, 38, "Rebooting...");
-            u8g2.sendBuffer();
+            sendDisplayFrame();
             delay(1000);
             ESP.restart();
         }
@@ -203,34 +226,40 @@ void loop() {
 
     handleWiFiConnection();
     handleHistoricDataTransfer();
+    handleRollupTransfer();
     handleRealtimeData();
     updateSensorReadings();
     checkAlarm();
-    handleEncoder();
-    handleEncoderPush();
-
-    if (!isAlarmRinging) {
-        handleButtons();
+    if (!otaReceiving) {
+        handleEncoder();
+        handleEncoderPush();
+        if (!isAlarmRinging) {
+            handleButtons();
+        }
+        handleBackButton();
     }
 
-    handleBackButton();
-
-    if (wifiState == WIFI_CONNECTED && millis() - lastNTPResync >= NTP_RESYNC_INTERVAL) {
+    if (!otaReceiving && wifiState == WIFI_CONNECTED && millis() - lastNTPResync >= NTP_RESYNC_INTERVAL) {
         Serial.println("DEBUG: NTP resync interval reached, forcing sync.");
         syncTimeNTPForce();
     }
     if (millis() - lastHistoryRecord > historyRecordInterval) {
-        lastHistoryRecord = millis();
+        // 以固定步進排程，避免 loop 延遲累積成時間漂移；落後太多 (例如阻塞) 才重新對齊
+        lastHistoryRecord += historyRecordInterval;
+        if (millis() - lastHistoryRecord > historyRecordInterval) lastHistoryRecord = millis();
         if (sensorDataValid) {
             addDataToHistory(cachedTemp, cachedHum, WiFi.RSSI());
         }
     }
-    if (wifiState == WIFI_CONNECTED && millis() - lastWeatherUpdate > WEATHER_INTERVAL) {
+    handleHistoryCommit();
+    handleSettingsCommit();
+    handleHeapMonitor();
+    if (!otaReceiving && wifiState == WIFI_CONNECTED && millis() - lastWeatherUpdate > WEATHER_INTERVAL) {
         Serial.println("DEBUG: Weather update interval reached, fetching new data.");
         fetchWeatherData();
         lastWeatherUpdate = millis();
     }
-    if (millis() - lastDisplayUpdate >= displayInterval) {
-        updateDisplay();
+    if (!otaReceiving) {
+        handleDisplayRefresh(); // 只在畫面失效或到期時重畫 (見 display.cpp)
     }
 }
@@ -0,0 +1,116 @@
+#include "globals.h"
+#include "ble_events.h"
+#include "ble_notify.h"
+
+// Pre-declare functions from other modules that are used here
+int getBleClient();
+bool isBleClientConnected(int client);
+
+// ==================== 狀態變化事件 ====================
+// 每個連線各自訂閱；App 以 CMD_SUBSCRIBE_EVENTS 訂閱後不必再輪詢 0x14/0x20/0x30：loop() 每次比對可觀察狀態的快照，
+// 只把訂閱中且有變化的欄位以 CMD_REPORT_STATE_EVENT 推送，沒有變化時完全不產生流量。
+// 事件封包: opcode, 序號 (2B，訂閱後從 0 起每個事件 +1，App 可據此發現漏掉的事件), 欄位 mask (1B), 各欄位依位元順序:
+//   STATE_ALARM_RINGING  ringing(1B)
+//   STATE_ALARM_CONFIG   hour(1B) minute(1B) enabled(1B)
+//   STATE_WIFI           WiFiState(1B)
+//   STATE_SENSOR         valid(1B)
+//   STATE_ENG_MODE       enabled(1B)
+//   STATE_SLOTS          slot mask(1B，與 0x80 相同)
+struct ObservableState {
+    bool alarmRinging;
+    uint8_t alarmHour, alarmMinute;
+    bool alarmEnabled;
+    uint8_t wifi;
+    bool sensorValid;
+    bool engMode;
+    uint8_t slots;
+};
+
+static ObservableState publishedState;
+static bool stateInitialized = false;
+struct EventSubscription {
+    uint8_t mask = 0;
+    uint8_t pending = 0;               // 訂閱時要送出的完整快照
+    uint16_t seq = 0;
+};
+static EventSubscription subscriptions[BLE_MAX_CONNECTIONS];
+
+static ObservableState captureState() {
+    ObservableState s;
+    s.alarmRinging = isAlarmRinging;
+    s.alarmHour = alarmHour;
+    s.alarmMinute = alarmMinute;
+    s.alarmEnabled = alarmEnabled;
+    s.wifi = wifiState;
+    s.sensorValid = sensorDataValid;
+    s.engMode = isEngineeringMode;
+    s.slots = slotStatusMask;
+    return s;
+}
+
+static uint8_t diffState(const ObservableState& a, const ObservableState& b) {
+    uint8_t changed = 0;
+    if (a.alarmRinging != b.alarmRinging) changed |= STATE_ALARM_RINGING;
+    if (a.alarmHour != b.alarmHour || a.alarmMinute != b.alarmMinute || a.alarmEnabled != b.alarmEnabled) changed |= STATE_ALARM_CONFIG;
+    if (a.wifi != b.wifi) changed |= STATE_WIFI;
+    if (a.sensorValid != b.sensorValid) changed |= STATE_SENSOR;
+    if (a.engMode != b.engMode) changed |= STATE_ENG_MODE;
+    if (a.slots != b.slots) changed |= STATE_SLOTS;
+    return changed;
+}
+
+static void sendStateEvent(int client, uint8_t mask, const ObservableState& s) {
+    uint8_t packet[12];
+    size_t n = 0;
+    packet[n++] = CMD_REPORT_STATE_EVENT;
+    memcpy(&packet[n], &subscriptions[client].seq, 2);
+    n += 2;
+    subscriptions[client].seq++;
+    packet[n++] = mask;
+    if (mask & STATE_ALARM_RINGING) packet[n++] = s.alarmRinging;
+    if (mask & STATE_ALARM_CONFIG) {
+        packet[n++] = s.alarmHour;
+        packet[n++] = s.alarmMinute;
+        packet[n++] = s.alarmEnabled;
+    }
+    if (mask & STATE_WIFI) packet[n++] = s.wifi;
+    if (mask & STATE_SENSOR) packet[n++] = s.sensorValid;
+    if (mask & STATE_ENG_MODE) packet[n++] = s.engMode;
+    if (mask & STATE_SLOTS) packet[n++] = s.slots;
+    queueNotifyTo(client, packet, n);
+}
+
+// 目前處理中的連線訂閱；mask = 0 取消訂閱。訂閱後立即送出一次訂閱欄位的目前值
+void subscribeStateEvents(uint8_t mask) {
+    int client = getBleClient();
+    if (client < 0) return;
+    EventSubscription& sub = subscriptions[client];
+    sub.mask = mask & STATE_ALL;
+    sub.pending = sub.mask;
+    sub.seq = 0;
+    Serial.printf("DEBUG: Client %d state events %s (mask 0x%02X).\n", client, sub.mask ? "subscribed" : "unsubscribed", sub.mask);
+    handleStateEvents();
+}
+
+// 連線建立與中斷時清除 (訂閱只在該次連線有效)
+void resetStateEvents(int client) {
+    subscriptions[client] = EventSubscription();
+}
+
+void handleStateEvents() {
+    ObservableState current = captureState();
+    if (!stateInitialized) {
+        publishedState = current;
+        stateInitialized = true;
+    }
+    uint8_t changed = diffState(publishedState, current);
+    if (changed) publishedState = current;
+    if (!bleDeviceConnected) return;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        EventSubscription& sub = subscriptions[i];
+        uint8_t mask = (changed | sub.pending) & sub.mask;
+        if (mask == 0 || !isBleClientConnected(i)) continue;
+        sub.pending = 0;
+        sendStateEvent(i, mask, current);
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <Arduino.h>
+
+void subscribeStateEvents(uint8_t mask);
+void resetStateEvents(int client);
+void handleStateEvents();
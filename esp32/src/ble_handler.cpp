@@ -1,35 +1,232 @@
 #include "globals.h"
-#include <Update.h> // <--- 新增
+#include "ble_ota.h"
+#include "ble_notify.h"
+#include "ble_events.h"
+#include "ble_link.h"
+#include "history_codec.h"
 #include <BLEDevice.h>
 #include <BLEServer.h>
 #include <BLEUtils.h>
 #include <BLE2902.h>
+#include <esp_gap_ble_api.h>
 #include <sys/time.h>
+#include <atomic>
 
 // Pre-declare functions from other modules that are used here
 void updateScreens();
 void guideToSlot(int slot);
+int getOtaClient();
+
+// ---- 連線 ----
+// 最多同時服務 BLE_MAX_CONNECTIONS 個 central (例如病患的手機與照護者的平板)。每個連線有自己的 MTU、
+// 歷史/彙總傳輸進度與即時數據設定；notify 佇列與事件訂閱分別在 ble_notify.cpp、ble_events.cpp 中依連線保存。
+// 處理某個連線的指令或傳輸時 currentClient 指向該連線，回報 (queueNotify) 只送給它；
+// 不屬於任何連線的回報 (例如按鍵觸發的服藥紀錄) currentClient 為 -1，送給所有連線。
+struct BleClient {
+    bool active = false;
+    uint16_t connId = 0;
+    uint16_t mtu = BLE_DEFAULT_MTU;      // 協商出的 ATT MTU；notify 內容最多 mtu - 3 bytes
+    uint32_t rxBytes = 0;                // 收到的指令 bytes (吞吐量統計)
+
+    // 歷史資料傳輸
+    bool sendingHistoric = false;
+    int historicIndex = 0;               // 下一筆要讀取的紀錄
+    uint32_t historicSince = 0;          // 增量同步：只傳送晚於此時間的紀錄，0 = 全部
+    uint32_t historicCursor = 0;         // 已送出的最新紀錄時間，結束封包回報給 App 作為下次的 since
+    uint8_t historicMaxPoints = HISTORIC_LEGACY_MAX_POINTS; // App 能接受的每包筆數上限
+    bool historicCompact = false;        // 0x35：以壓縮區塊 (0x95) 傳送
+    uint8_t historicBlockSeq = 0;
+    unsigned long historicStartTime = 0;
+    uint32_t historicPointsSent = 0;
+    uint32_t historicBytesSent = 0;
+    uint32_t historicPacketsSent = 0;
+    DataPoint historicReadBuffer[32];    // 每次從儲存層批次讀取一段紀錄，避免每筆都開檔/seek
+    int historicReadFirst = 0;
+    int historicReadCount = 0;
+
+    // 彙總資料傳輸：由舊到新每次 loop 送出一個有資料的 bucket，空的時段略過
+    bool sendingRollup = false;
+    RollupTier rollupTier = ROLLUP_MINUTE;
+    uint32_t rollupNextTime = 0;         // 下一段要讀取的第一個 bucket 內的時間
+    int rollupLeft = 0;                  // 尚未讀取的 bucket 數
+    int rollupSent = 0;
+    RollupBucket rollupReadBuffer[16];
+    int rollupReadPos = 0;
+    int rollupReadCount = 0;
+
+    // 即時數據串流
+    bool realtimeEnabled = false;
+    uint16_t realtimeMinInterval = REALTIME_DEFAULT_MIN_MS;
+    uint16_t realtimeMaxInterval = REALTIME_DEFAULT_MAX_MS;
+    uint8_t realtimeTempThreshold = 0;   // 0.1°C，0 = 不以溫度觸發 (兩個門檻都是 0 時每個新樣本都送)
+    uint8_t realtimeHumThreshold = 0;    // %，0 = 不以濕度觸發
+    int16_t realtimeLastTemp = 0;        // 上次送出的數值 (0.1°C / %)
+    int16_t realtimeLastHum = 0;
+    bool realtimeHasSent = false;
+    bool realtimePending = false;        // 有超過門檻的新樣本等待送出
+    unsigned long realtimeLastSend = 0;
+};
+static BleClient clients[BLE_MAX_CONNECTIONS];
+static int currentClient = -1;
+static BLEServer* bleServer = nullptr;
+static std::atomic<int> connectionCount(0); // BLE task 用來決定是否繼續廣播
+
+static void handleClientRealtime(BleClient& client);
+
+int getBleClient() {
+    return currentClient;
+}
+
+bool isBleClientConnected(int client) {
+    return client >= 0 && client < BLE_MAX_CONNECTIONS && clients[client].active;
+}
+
+uint16_t getBleClientConnId(int client) {
+    return clients[client].connId;
+}
+
+uint32_t getBleClientRxBytes(int client) {
+    return clients[client].rxBytes;
+}
+
+// 有大量傳輸 (歷史、彙總) 或 OTA 正在使用此連線
+bool isBleClientBusy(int client) {
+    return clients[client].sendingHistoric || clients[client].sendingRollup || getOtaClient() == client;
+}
+
+uint16_t getBleMtu() {
+    return currentClient >= 0 ? clients[currentClient].mtu : BLE_DEFAULT_MTU;
+}
+
+static int findClient(uint16_t connId) {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (clients[i].active && clients[i].connId == connId) return i;
+    }
+    return -1;
+}
+
+// ---- 指令佇列 ----
+// BLE 的 callback 在 BLE host task 中執行；為了不讓 flash 寫入、NVS、繪圖與馬達延遲卡住 BLE，
+// 也不和 loop() 同時修改全域狀態，callback 只把寫入內容與連線事件複製進單一生產者/單一消費者的環形佇列，
+// 由 loop() 呼叫 handleBleCommands() 依序處理。每個 slot 記錄所屬的連線 (conn_id)。
+enum BleEventType : uint8_t {
+    BLE_EVENT_WRITE,
+    BLE_EVENT_CONNECT,   // data = 對方位址 (6B)
+    BLE_EVENT_DISCONNECT,
+    BLE_EVENT_MTU,       // data = 協商出的 MTU (2B)
+    BLE_EVENT_DROPPED,   // 此連線有寫入因佇列已滿被丟棄
+};
+struct BleCommandSlot {
+    uint8_t type;
+    uint16_t connId;
+    uint16_t length;
+    uint8_t data[BLE_COMMAND_MAX_LENGTH];
+};
+static BleCommandSlot commandQueue[BLE_COMMAND_QUEUE_SLOTS];
+static std::atomic<uint16_t> commandHead(0);     // 下一個寫入的 slot (只由 BLE task 修改)
+static std::atomic<uint16_t> commandTail(0);     // 下一個讀取的 slot (只由 loop() 修改)
+static std::atomic<uint32_t> commandsDropped(0);
+static std::atomic<uint32_t> disconnectPending(0); // 佇列已滿時斷線事件的備援 (bit = conn_id)
+
+static bool enqueueEvent(uint8_t type, uint16_t connId, const uint8_t* data, size_t length) {
+    uint16_t head = commandHead.load(std::memory_order_relaxed);
+    uint16_t depth = (head + BLE_COMMAND_QUEUE_SLOTS - commandTail.load(std::memory_order_acquire)) % BLE_COMMAND_QUEUE_SLOTS;
+    // 最後幾個 slot 保留給連線事件，寫入再多也不會擠掉其他連線的連線/斷線事件
+    int limit = BLE_COMMAND_QUEUE_SLOTS - 1 - (type == BLE_EVENT_WRITE ? BLE_COMMAND_RESERVED_SLOTS : 0);
+    if (depth >= limit) return false;
+    BleCommandSlot& slot = commandQueue[head];
+    slot.type = type;
+    slot.connId = connId;
+    slot.length = length;
+    if (length > 0) memcpy(slot.data, data, length);
+    commandHead.store((head + 1) % BLE_COMMAND_QUEUE_SLOTS, std::memory_order_release);
+    bleLinkStats.commandsReceived += type == BLE_EVENT_WRITE;
+    if (depth + 1 > bleLinkStats.commandQueuePeak) bleLinkStats.commandQueuePeak = depth + 1;
+    return true;
+}
+
+// 寫入被丟棄時通知該連線的 App 重送；同一連線連續溢位只放一個事件
+static void dropWrite(uint16_t connId) {
+    commandsDropped++;
+    uint16_t head = commandHead.load(std::memory_order_relaxed);
+    const BleCommandSlot& last = commandQueue[(head + BLE_COMMAND_QUEUE_SLOTS - 1) % BLE_COMMAND_QUEUE_SLOTS];
+    if (head != commandTail.load(std::memory_order_acquire) && last.type == BLE_EVENT_DROPPED && last.connId == connId) return;
+    enqueueEvent(BLE_EVENT_DROPPED, connId, nullptr, 0);
+}
+
+static void updateConnectionState() {
+    int count = 0;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) count += clients[i].active;
+    bleDeviceConnected = count > 0;
+    if (count > bleLinkStats.clientsPeak) bleLinkStats.clientsPeak = count;
+}
+
+static void handleBleConnect(uint16_t connId, const uint8_t* bda) {
+    int c = findClient(connId);
+    for (int i = 0; c < 0 && i < BLE_MAX_CONNECTIONS; i++) {
+        if (!clients[i].active) c = i;
+    }
+    if (c < 0) {
+        Serial.printf("ERROR: No free BLE client slot for conn %u, disconnecting.\n", connId);
+        bleServer->disconnect(connId);
+        return;
+    }
+    clients[c] = BleClient();
+    clients[c].active = true;
+    clients[c].connId = connId;
+    clearNotifyQueue(c);
+    resetStateEvents(c);
+    openLinkProfile(c, bda);
+    updateConnectionState();
+    Serial.printf("DEBUG: BLE client %d connected (conn %u).\n", c, connId);
+}
+
+static void handleBleDisconnect(uint16_t connId) {
+    int c = findClient(connId);
+    if (c < 0) return;
+    BleClient& client = clients[c];
+    if (client.sendingHistoric) Serial.printf("BLE client %d disconnected during transfer. Aborting.\n", c);
+    if (client.sendingRollup) Serial.printf("BLE client %d disconnected during rollup transfer. Aborting.\n", c);
+    closeLinkProfile(c);
+    resetStateEvents(c);
+    clearNotifyQueue(c);
+    handleOtaDisconnect(c); // 舊版 OTA 中止，視窗式 OTA 保留進度等待續傳
+    client.active = false;
+    updateConnectionState();
+    Serial.printf("DEBUG: BLE client %d disconnected (conn %u).\n", c, connId);
+    logBleLinkStats();
+}
 
 class MyServerCallbacks: public BLEServerCallbacks {
-    void onConnect(BLEServer* pServer) {
-        bleDeviceConnected = true;
-        Serial.println("DEBUG: BLE Client Connected");
+    void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        enqueueEvent(BLE_EVENT_CONNECT, param->connect.conn_id, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+        // MTU 交換只能由手機發起；Data Length Extension 可以由裝置要求，讓大封包不必在 link layer 拆段
+        esp_err_t err = esp_ble_gap_set_pkt_data_len(param->connect.remote_bda, BLE_LE_DATA_LENGTH);
+        if (err != ESP_OK) Serial.printf("DEBUG: LE data length request failed (%d)\n", err);
+        // 連線後堆疊會停止廣播；還有空位時繼續廣播，讓其他裝置也能連上
+        if (++connectionCount < BLE_MAX_CONNECTIONS) BLEDevice::startAdvertising();
+        Serial.printf("DEBUG: BLE Client Connected (conn %u, %d/%d)\n", param->connect.conn_id, connectionCount.load(), BLE_MAX_CONNECTIONS);
     }
-    void onDisconnect(BLEServer* pServer) {
-        bleDeviceConnected = false;
-        isRealtimeEnabled = false;
-        isBleOtaInProgress = false; // <--- 新增: 如果中途斷線，終止 OTA
-        Serial.println("DEBUG: BLE Client Disconnected");
+    void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        enqueueEvent(BLE_EVENT_MTU, param->mtu.conn_id, (const uint8_t*)&param->mtu.mtu, 2);
+        Serial.printf("DEBUG: BLE MTU negotiated: %u (conn %u)\n", param->mtu.mtu, param->mtu.conn_id);
+    }
+    void onDisconnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+        uint16_t connId = param->disconnect.conn_id;
+        if (!enqueueEvent(BLE_EVENT_DISCONNECT, connId, nullptr, 0) && connId < 32) disconnectPending |= 1UL << connId;
+        if (connectionCount > 0) connectionCount--;
+        Serial.printf("DEBUG: BLE Client Disconnected (conn %u)\n", connId);
         BLEDevice::startAdvertising();
     }
 };
 
 class CommandCallbacks: public BLECharacteristicCallbacks {
-    void onWrite(BLECharacteristic *pCharacteristic) {
-        std::string value = pCharacteristic->getValue();
-        if (value.length() > 0) {
-            // Serial.printf("DEBUG: BLE command received, length: %d\n", value.length()); // Can be verbose
-            handleCommand((uint8_t*)value.c_str(), value.length());
+    void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t* param) {
+        // 直接讀取特徵值緩衝，避免在 BLE task 中配置 std::string
+        size_t length = pCharacteristic->getLength();
+        if (length == 0) return;
+        if (length > BLE_COMMAND_MAX_LENGTH || !enqueueEvent(BLE_EVENT_WRITE, param->write.conn_id, pCharacteristic->getData(), length)) {
+            dropWrite(param->write.conn_id);
         }
     }
 };
@@ -37,13 +234,16 @@ class CommandCallbacks: public BLECharacteristicCallbacks {
 void setupBLE() {
     Serial.println("DEBUG: setupBLE");
     BLEDevice::init("SmartMedBox");
-    BLEServer *pServer = BLEDevice::createServer();
-    pServer->setCallbacks(new MyServerCallbacks());
-    BLEService *pService = pServer->createService(SERVICE_UUID);
-    BLECharacteristic* pCommand = pService->createCharacteristic(COMMAND_CHANNEL_UUID, BLECharacteristic::PROPERTY_WRITE);
+    BLEDevice::setMTU(BLE_LOCAL_MTU);
+    bleServer = BLEDevice::createServer();
+    bleServer->setCallbacks(new MyServerCallbacks());
+    BLEService *pService = bleServer->createService(SERVICE_UUID);
+    BLECharacteristic* pCommand = pService->createCharacteristic(COMMAND_CHANNEL_UUID, BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR);
     pCommand->setCallbacks(new CommandCallbacks());
     pDataEventCharacteristic = pService->createCharacteristic(DATA_EVENT_CHANNEL_UUID, BLECharacteristic::PROPERTY_NOTIFY);
     pDataEventCharacteristic->addDescriptor(new BLE2902());
+    setupNotifyQueue(pDataEventCharacteristic);
+    setupLinkProfiles();
     pService->start();
     BLEDevice::getAdvertising()->addServiceUUID(SERVICE_UUID);
     BLEDevice::getAdvertising()->setScanResponse(true);
@@ -51,13 +251,94 @@ void setupBLE() {
     Serial.println("DEBUG: BLE Server started and advertising.");
 }
 
+static void startRollupTransfer(BleClient& client, RollupTier tier, int count, uint32_t endTime) {
+    count = constrain(count, 1, rollupCapacity(tier));
+    client.rollupTier = tier;
+    client.rollupNextTime = endTime - (count - 1) * rollupPeriod(tier);
+    client.rollupLeft = count;
+    client.rollupSent = 0;
+    client.rollupReadPos = client.rollupReadCount = 0;
+    client.sendingRollup = true;
+    Serial.printf("Starting rollup transfer for client %d: tier %d, %d buckets.\n", currentClient, tier, count);
+}
+
+// loop() 中呼叫：依序處理 BLE task 放入佇列的指令與連線事件
+void handleBleCommands() {
+    uint16_t tail = commandTail.load(std::memory_order_relaxed);
+    while (tail != commandHead.load(std::memory_order_acquire)) {
+        BleCommandSlot& slot = commandQueue[tail];
+        switch (slot.type) {
+            case BLE_EVENT_WRITE:
+                currentClient = findClient(slot.connId);
+                if (currentClient >= 0) {
+                    clients[currentClient].rxBytes += slot.length;
+                    handleCommand(slot.data, slot.length);
+                }
+                currentClient = -1;
+                break;
+            case BLE_EVENT_CONNECT:
+                handleBleConnect(slot.connId, slot.data);
+                break;
+            case BLE_EVENT_DISCONNECT:
+                handleBleDisconnect(slot.connId);
+                break;
+            case BLE_EVENT_MTU: {
+                int c = findClient(slot.connId);
+                if (c >= 0) memcpy(&clients[c].mtu, slot.data, 2);
+                break;
+            }
+            case BLE_EVENT_DROPPED:
+                currentClient = findClient(slot.connId);
+                Serial.printf("ERROR: BLE command queue overflow on client %d (total %lu dropped, peak depth %u).\n",
+                              currentClient, (unsigned long)commandsDropped.load(), bleLinkStats.commandQueuePeak);
+                if (currentClient >= 0) sendErrorReport(0x06); // Busy: 有指令未被處理，App 需重送
+                currentClient = -1;
+                break;
+        }
+        tail = (tail + 1) % BLE_COMMAND_QUEUE_SLOTS;
+        commandTail.store(tail, std::memory_order_release);
+    }
+    uint32_t pending = disconnectPending.exchange(0);
+    for (uint16_t connId = 0; pending; connId++, pending >>= 1) {
+        if (pending & 1) handleBleDisconnect(connId);
+    }
+    bleLinkStats.commandsDropped = commandsDropped;
+}
+
+// 批次指令：一次寫入多個子指令，減少連線初期的來回次數。
+// 先檢查整個封包的長度欄位，有誤就一個都不執行；子指令不可再是批次指令或 OTA 指令。
+static void handleBatchCommand(uint8_t* data, size_t length) {
+    int count = 0;
+    size_t pos = 1;
+    while (pos < length) {
+        uint8_t subLength = data[pos];
+        uint8_t subCommand = pos + 1 < length ? data[pos + 1] : 0;
+        bool allowed = subCommand != CMD_BATCH && !(subCommand >= CMD_OTA_START && subCommand <= CMD_OTA_ABORT);
+        if (subLength == 0 || pos + 1 + subLength > length || !allowed) {
+            Serial.printf("ERROR: Malformed batch at byte %u.\n", pos);
+            sendErrorReport(0x05);
+            return;
+        }
+        pos += 1 + subLength;
+        count++;
+    }
+    Serial.printf("DEBUG: CMD_BATCH received, %d sub-commands.\n", count);
+    beginNotifyBatch(CMD_REPORT_BATCH, getBleMtu() - 3);
+    for (pos = 1; pos < length; pos += 1 + data[pos]) {
+        handleCommand(&data[pos + 1], data[pos]);
+    }
+    endNotifyBatch();
+}
+
+// 由 handleBleCommands() 呼叫，currentClient 為送出指令的連線
 void handleCommand(uint8_t* data, size_t length) {
-    if (length == 0) return;
+    if (length == 0 || currentClient < 0) return;
     uint8_t command = data[0];
+    BleClient& client = clients[currentClient];
     
     // For OTA data, avoid printing every packet to prevent log spam
-    if (command != CMD_OTA_DATA) {
-        Serial.printf("BLE RX: CMD=0x%02X, Len=%d\n", command, length);
+    if (command != CMD_OTA_DATA && command != CMD_OTA_CHUNK) {
+        Serial.printf("BLE RX[%d]: CMD=0x%02X, Len=%d\n", currentClient, command, length);
     }
 
     switch (command) {
@@ -65,8 +346,7 @@ void handleCommand(uint8_t* data, size_t length) {
             if (length == 1) {
                 Serial.println("DEBUG: CMD_PROTOCOL_VERSION received.");
                 uint8_t packet[2] = {CMD_REPORT_PROTO_VER, 2};
-                pDataEventCharacteristic->setValue(packet, 2);
-                pDataEventCharacteristic->notify();
+                queueNotify(packet, 2);
             }
             break;
         case CMD_TIME_SYNC:
@@ -90,10 +370,7 @@ void handleCommand(uint8_t* data, size_t length) {
                     String newSSID = String((char*)&data[2], ssidLen);
                     String newPASS = String((char*)&data[3 + ssidLen], passLen);
                     Serial.printf("DEBUG: CMD_WIFI_CREDENTIALS received. SSID: %s\n", newSSID.c_str());
-                    preferences.begin("wifi", false);
-                    preferences.putString("ssid", newSSID);
-                    preferences.putString("pass", newPASS);
-                    preferences.end();
+                    setWiFiCredentials(newSSID, newPASS);
                     startWiFiConnection();
                     sendTimeSyncAck();
                 }
@@ -101,11 +378,8 @@ void handleCommand(uint8_t* data, size_t length) {
             break;
         case CMD_SET_ENGINEERING_MODE:
             if (length == 2) {
-                isEngineeringMode = (data[1] == 0x01);
+                setEngineeringMode(data[1] == 0x01);
                 Serial.printf("DEBUG: CMD_SET_ENGINEERING_MODE received. Mode: %s\n", isEngineeringMode ? "ON" : "OFF");
-                preferences.begin("medbox-meta", false);
-                preferences.putBool("engMode", isEngineeringMode);
-                preferences.end();
                 updateScreens();
                 sendTimeSyncAck();
             }
@@ -115,8 +389,7 @@ void handleCommand(uint8_t* data, size_t length) {
                 Serial.println("DEBUG: CMD_REQUEST_ENG_MODE_STATUS received.");
                 uint8_t status = isEngineeringMode ? 0x01 : 0x00;
                 uint8_t packet[2] = {CMD_REPORT_ENG_MODE_STATUS, status};
-                pDataEventCharacteristic->setValue(packet, 2);
-                pDataEventCharacteristic->notify();
+                queueNotify(packet, 2);
             }
             break;
         case CMD_SET_ALARM:
@@ -125,14 +398,7 @@ void handleCommand(uint8_t* data, size_t length) {
                 uint8_t newMinute = data[2];
                 bool newEnabled = (data[3] != 0);
                 if (newHour < 24 && newMinute < 60) {
-                    alarmHour = newHour;
-                    alarmMinute = newMinute;
-                    alarmEnabled = newEnabled;
-                    preferences.begin("medbox-meta", false);
-                    preferences.putUChar("alarmH", alarmHour);
-                    preferences.putUChar("alarmM", alarmMinute);
-                    preferences.putBool("alarmOn", alarmEnabled);
-                    preferences.end();
+                    setAlarm(newHour, newMinute, newEnabled);
                     Serial.printf("DEBUG: Alarm set to %02d:%02d, Enabled: %d\n", alarmHour, alarmMinute, alarmEnabled);
                 }
             }
@@ -145,6 +411,13 @@ void handleCommand(uint8_t* data, size_t length) {
                 guideToSlot(slot);
             }
             break;            
+        case CMD_SUBSCRIBE_EVENTS:
+            if (length == 2) {
+                subscribeStateEvents(data[1]);
+            } else {
+                sendErrorReport(0x05);
+            }
+            break;
         case CMD_REQUEST_STATUS:
             Serial.println("DEBUG: CMD_REQUEST_STATUS received.");
             sendBoxStatus();
@@ -154,130 +427,81 @@ void handleCommand(uint8_t* data, size_t length) {
             sendSensorDataReport();
             break;
         case CMD_REQUEST_HISTORIC:
-            Serial.println("DEBUG: CMD_REQUEST_HISTORIC received.");
-            if (!isSendingHistoricData) {
-                isSendingHistoricData = true;
-                historicDataIndexToSend = 0;
-                historicDataStartTime = millis();
-                Serial.println("Starting historic data transfer (batch mode)...");
+        case CMD_REQUEST_HISTORIC_COMPACT:
+            Serial.printf("DEBUG: CMD_REQUEST_HISTORIC%s received.\n", command == CMD_REQUEST_HISTORIC_COMPACT ? "_COMPACT" : "");
+            // 傳送中再次要求 (例如 App 逾時後重送) 時以新的參數重新開始
+            if (client.sendingHistoric) {
+                Serial.printf("DEBUG: Restarting historic transfer for client %d after %lu points.\n", currentClient, (unsigned long)client.historicPointsSent);
             }
+            // 附帶 4-byte since 時間戳時只傳送更新的紀錄 (增量同步)，否則傳送全部；
+            // 第 6 byte 為 App 能接受的每包筆數上限，沒有時沿用舊版 App 的 5 筆
+            client.historicSince = 0;
+            if (length >= 5) memcpy(&client.historicSince, &data[1], 4);
+            client.historicMaxPoints = HISTORIC_LEGACY_MAX_POINTS;
+            if (length >= 6 && data[5] > 0) client.historicMaxPoints = min((int)data[5], HISTORIC_MAX_POINTS_PER_PACKET);
+            client.historicCursor = client.historicSince;
+            client.historicCompact = command == CMD_REQUEST_HISTORIC_COMPACT;
+            client.historicBlockSeq = 0;
+            client.historicPointsSent = client.historicBytesSent = client.historicPacketsSent = 0;
+            client.historicReadCount = 0;
+            client.historicIndex = client.historicSince ? findHistoryIndexAfter(client.historicSince) : 0;
+            client.historicStartTime = millis();
+            client.sendingHistoric = true;
+            Serial.printf("Starting historic data transfer for client %d (%s mode) from index %d, since %lu, MTU %u, max %u points/packet...\n",
+                          currentClient, client.historicCompact ? "compact" : "batch", client.historicIndex, (unsigned long)client.historicSince, client.mtu, client.historicMaxPoints);
             break;
-        case CMD_ENABLE_REALTIME:
-            Serial.println("DEBUG: CMD_ENABLE_REALTIME received.");
-            isRealtimeEnabled = true;
+        case CMD_REQUEST_ROLLUP:
+            Serial.println("DEBUG: CMD_REQUEST_ROLLUP received.");
+            if (length >= 4 && data[1] < ROLLUP_TIER_COUNT) {
+                uint32_t endTime = time(nullptr);
+                if (length >= 8) memcpy(&endTime, &data[4], 4);
+                if (endTime < MIN_VALID_EPOCH) {
+                    sendErrorReport(0x04); // 尚未對時，無法定位時段
+                    break;
+                }
+                startRollupTransfer(client, (RollupTier)data[1], data[2] | (data[3] << 8), endTime);
+            } else {
+                sendErrorReport(0x05);
+            }
+            break;
+        case CMD_ENABLE_REALTIME: {
+            // 參數皆可省略：最短/最長間隔 (ms)、溫度 (0.1°C) 與濕度 (%) 的變化門檻
+            uint16_t minInterval = REALTIME_DEFAULT_MIN_MS, maxInterval = REALTIME_DEFAULT_MAX_MS;
+            if (length >= 3) memcpy(&minInterval, &data[1], 2);
+            if (length >= 5) memcpy(&maxInterval, &data[3], 2);
+            client.realtimeMinInterval = minInterval;
+            client.realtimeMaxInterval = maxInterval;
+            client.realtimeTempThreshold = length >= 6 ? data[5] : 0;
+            client.realtimeHumThreshold = length >= 7 ? data[6] : 0;
+            Serial.printf("DEBUG: CMD_ENABLE_REALTIME received. Interval %u-%u ms, deadband %.1f C / %u %%\n",
+                          client.realtimeMinInterval, client.realtimeMaxInterval, client.realtimeTempThreshold / 10.0, client.realtimeHumThreshold);
+            client.realtimeEnabled = true;
+            client.realtimePending = true; // 啟用後立即送出目前數值
+            client.realtimeHasSent = false;
             sendTimeSyncAck();
+            handleClientRealtime(client);
             break;
+        }
         case CMD_DISABLE_REALTIME:
             Serial.println("DEBUG: CMD_DISABLE_REALTIME received.");
-            isRealtimeEnabled = false;
+            client.realtimeEnabled = false;
             sendTimeSyncAck();
             break;
 
-        // =======================================
-        // ===== 新增的 BLE OTA 處理邏輯 Start =====
-        // =======================================
-        case CMD_OTA_START: {
-            if (length < 5) {
-                Serial.println("ERROR: CMD_OTA_START packet too short!");
-                sendErrorReport(0x05); // Length error
-                break;
-            }
-            // 從封包中解析韌體總大小 (4 bytes, little-endian)
-            otaTotalSize = (data[4] << 24) | (data[3] << 16) | (data[2] << 8) | data[1];
-            otaBytesReceived = 0;
-            
-            Serial.printf("DEBUG: CMD_OTA_START received. Total size: %u bytes\n", otaTotalSize);
-
-            // Display OTA message on screen
-            u8g2.clearBuffer();
-            u8g2.setFont(u8g2_font_ncenB10_tr);
-            u8g2.drawStr((128 - u8g2.getStrWidth("BLE OTA"))/2, 20, "BLE OTA");
-            u8g2.setFont(u8g2_font_ncenB08_tr);
-            u8g2.drawStr((128 - u8g2.getStrWidth("Receiving..."))/2, 40, "Receiving...");
-            u8g2.sendBuffer();
-
-            if (Update.begin(otaTotalSize)) {
-                isBleOtaInProgress = true;
-                otaStartTime = millis();
-                Serial.println("DEBUG: OTA Update process started.");
-            } else {
-                Serial.println("ERROR: Not enough space to begin OTA");
-                Update.printError(Serial);
-                sendErrorReport(0x04); // Access error / insufficient space
-            }
+        case CMD_BATCH:
+            handleBatchCommand(data, length);
             break;
-        }
 
-        case CMD_OTA_DATA: {
-            if (!isBleOtaInProgress) {
-                Serial.println("ERROR: CMD_OTA_DATA received without START.");
-                sendErrorReport(0x03); // Unknown command / wrong sequence
-                break;
-            }
-            
-            size_t chunkSize = length - 1;
-            
-            if (chunkSize > 0) {
-                size_t bytesWritten = Update.write(&data[1], chunkSize);
-                if (bytesWritten == chunkSize) {
-                    otaBytesReceived += bytesWritten;
-                    // Update progress on screen
-                    int progress = (int)((otaBytesReceived * 100) / otaTotalSize);
-                    u8g2.drawBox(0, 50, 128, 10);
-                    u8g2.setDrawColor(0); // color 0 for the text
-                    char progressStr[5];
-                    sprintf(progressStr, "%d%%", progress);
-                    u8g2.drawStr((128 - u8g2.getStrWidth(progressStr))/2, 60, progressStr);
-                    u8g2.setDrawColor(1); // Back to default
-                    u8g2.drawBox(2, 52, (124 * progress) / 100, 6);
-                    u8g2.sendBuffer();
-
-                } else {
-                    Serial.println("ERROR: OTA data write failed!");
-                    Update.printError(Serial);
-                    isBleOtaInProgress = false;
-                    sendErrorReport(0x04); // Access error
-                }
-            }
+        // ---- BLE OTA (見 ble_ota.cpp) ----
+        case CMD_OTA_START:
+        case CMD_OTA_DATA:
+        case CMD_OTA_END:
+        case CMD_OTA_BEGIN:
+        case CMD_OTA_CHUNK:
+        case CMD_OTA_FINISH:
+        case CMD_OTA_ABORT:
+            handleOtaCommand(data, length);
             break;
-        }
-
-        case CMD_OTA_END: {
-            if (!isBleOtaInProgress) {
-                Serial.println("ERROR: CMD_OTA_END received without START.");
-                sendErrorReport(0x03); // Unknown command / wrong sequence
-                break;
-            }
-            
-            Serial.printf("DEBUG: CMD_OTA_END received. Total bytes received: %u\n", otaBytesReceived);
-
-            if (Update.end(true)) { 
-                Serial.printf("SUCCESS: OTA Update successful in %lu ms. Rebooting...\n", millis() - otaStartTime);
-                u8g2.clearBuffer();
-                u8g2.setFont(u8g2_font_ncenB08_tr);
-                u8g2.drawStr((128 - u8g2.getStrWidth("Update OK!"))/2, 20, "Update OK!");
-                u8g2.drawStr((128 - u8g2.getStrWidth("Rebooting..."))/2, 40, "Rebooting...");
-                u8g2.sendBuffer();
-                delay(2000);
-                ESP.restart();
-            } else {
-                Serial.println("ERROR: OTA Update failed!");
-                Update.printError(Serial);
-                isBleOtaInProgress = false;
-                u8g2.clearBuffer();
-                u8g2.setFont(u8g2_font_ncenB08_tr);
-                u8g2.drawStr((128 - u8g2.getStrWidth("Update Failed!"))/2, 38, "Update Failed!");
-                u8g2.sendBuffer();
-                delay(3000);
-                // Optionally restart or return to main screen
-                // ESP.restart(); 
-                sendErrorReport(0x04); 
-            }
-            break;
-        }
-        // =======================================
-        // ===== 新增的 BLE OTA 處理邏輯 End =======
-        // =======================================
 
         default:
             Serial.printf("Error: Unknown Command 0x%02X\n", command);
@@ -289,17 +513,15 @@ void handleCommand(uint8_t* data, size_t length) {
 void sendBoxStatus() {
     if (!bleDeviceConnected) return;
     // Serial.println("DEBUG: Sending box status.");
-    uint8_t packet[2] = {CMD_REPORT_STATUS, 0b00001111};
-    pDataEventCharacteristic->setValue(packet, 2);
-    pDataEventCharacteristic->notify();
+    uint8_t packet[2] = {CMD_REPORT_STATUS, slotStatusMask};
+    queueNotify(packet, 2);
 }
 
 void sendMedicationTaken(uint8_t slot) {
     if (!bleDeviceConnected || slot > 7) return;
     Serial.printf("DEBUG: Sending medication taken for slot %d.\n", slot);
     uint8_t packet[2] = {CMD_REPORT_TAKEN, slot};
-    pDataEventCharacteristic->setValue(packet, 2);
-    pDataEventCharacteristic->notify();
+    queueNotify(packet, 2);
 }
 
 void sendSensorDataReport() {
@@ -316,60 +538,60 @@ void sendSensorDataReport() {
     packet[0] = CMD_REPORT_ENV;
     memcpy(&packet[1], &t_val, 2);
     memcpy(&packet[3], &h_val, 2);
-    pDataEventCharacteristic->setValue(packet, 5);
-    pDataEventCharacteristic->notify();
+    queueNotify(packet, 5);
 }
 
 void sendRealtimeSensorData() {
-    if (!bleDeviceConnected || !isRealtimeEnabled) return;
+    if (currentClient < 0 || !clients[currentClient].realtimeEnabled) return;
     if (!sensorDataValid) return;
+    BleClient& client = clients[currentClient];
     int16_t t_val = (int16_t)(cachedTemp * 100);
     int16_t h_val = (int16_t)(cachedHum * 100);
     uint8_t packet[5];
     packet[0] = CMD_REPORT_ENV;
     memcpy(&packet[1], &t_val, 2);
     memcpy(&packet[3], &h_val, 2);
-    pDataEventCharacteristic->setValue(packet, 5);
-    pDataEventCharacteristic->notify();
+    queueNotify(packet, 5);
+    client.realtimeLastSend = millis();
+    client.realtimeLastTemp = lroundf(cachedTemp * 10);
+    client.realtimeLastHum = lroundf(cachedHum);
+    client.realtimeHasSent = true;
+    client.realtimePending = false;
 }
 
 void sendHistoricDataEnd() {
-    if (!bleDeviceConnected) return;
-    Serial.println("DEBUG: Sending end of historic data transfer.");
-    uint8_t packet[1] = {CMD_REPORT_HISTORIC_END};
-    pDataEventCharacteristic->setValue(packet, 1);
-    pDataEventCharacteristic->notify();
+    if (currentClient < 0) return;
+    uint32_t cursor = clients[currentClient].historicCursor;
+    Serial.printf("DEBUG: Sending end of historic data transfer to client %d, cursor %lu.\n", currentClient, (unsigned long)cursor);
+    uint8_t packet[5] = {CMD_REPORT_HISTORIC_END};
+    memcpy(&packet[1], &cursor, 4);
+    queueNotify(packet, 5);
 }
 
-void handleHistoricDataTransfer() {
-    if (!isSendingHistoricData) return;
-    if (historicDataIndexToSend == 0) {
-        historyFile = SPIFFS.open("/history.dat", "r");
-        if (!historyFile) {
-            Serial.println("DEBUG: Failed to open history file for transfer.");
-            sendErrorReport(0x04);
-            isSendingHistoricData = false;
-            return;
-        }
-    }
-    if (!bleDeviceConnected) {
-        historyFile.close();
-        isSendingHistoricData = false;
-        Serial.println("BLE disconnected during transfer. Aborting.");
-        return;
+static bool readHistoricPoint(BleClient& client, int index, DataPoint& dp) {
+    if (index < client.historicReadFirst || index >= client.historicReadFirst + client.historicReadCount) {
+        client.historicReadFirst = index;
+        client.historicReadCount = readHistoryRange(index, 32, client.historicReadBuffer);
+        if (client.historicReadCount == 0) return false;
     }
-    const int MAX_POINTS_PER_PACKET = 2; // Reduced for MTU size safety
-    uint8_t batchPacket[1 + MAX_POINTS_PER_PACKET * 8];
-    uint8_t pointsInBatch = 0;
+    dp = client.historicReadBuffer[index - client.historicReadFirst];
+    return true;
+}
+
+// 0x91：每包筆數依該連線的 MTU 決定 (MTU 可能在傳輸途中才完成交換)；預設 23 的 MTU 為 2 筆。
+// 回傳封包長度，0 = 沒有要送的紀錄，-1 = 讀取失敗
+static int fillHistoricBatch(BleClient& client, uint8_t* batchPacket) {
+    int maxPoints = constrain((client.mtu - 3 - 1) / 8, 1, (int)client.historicMaxPoints);
+    int pointsInBatch = 0;
     int packetWriteIndex = 1;
-    while (pointsInBatch < MAX_POINTS_PER_PACKET && historicDataIndexToSend < historyCount) {
+    while (pointsInBatch < maxPoints && client.historicIndex < historyCount) {
         DataPoint dp;
-        int startIdx = (historyIndex - historyCount + MAX_HISTORY) % MAX_HISTORY;
-        int currentReadIdx = (startIdx + historicDataIndexToSend) % MAX_HISTORY;
-        historyFile.seek(currentReadIdx * sizeof(DataPoint));
-        historyFile.read((uint8_t*)&dp, sizeof(DataPoint));
-        time_t timestamp = time(nullptr) - (historyCount - 1 - historicDataIndexToSend) * (historyRecordInterval / 1000);
-        
+        if (!readHistoricPoint(client, client.historicIndex, dp)) return -1;
+        client.historicIndex++;
+        if (isnan(dp.temp) || dp.time == 0 || dp.time <= client.historicSince) continue; // 空位、未對時或 App 已有的紀錄不傳送
+        client.historicCursor = max(client.historicCursor, dp.time);
+        uint32_t timestamp = dp.time;
+
         memcpy(&batchPacket[packetWriteIndex], &timestamp, 4);
         packetWriteIndex += 4;
         
@@ -382,42 +604,160 @@ void handleHistoricDataTransfer() {
         packetWriteIndex += 2;
         
         pointsInBatch++;
-        historicDataIndexToSend++;
     }
-    if (pointsInBatch > 0) {
-        batchPacket[0] = CMD_REPORT_HISTORIC_POINT;
-        pDataEventCharacteristic->setValue(batchPacket, 1 + pointsInBatch * 8);
-        pDataEventCharacteristic->notify();
+    if (pointsInBatch == 0) return 0;
+    batchPacket[0] = CMD_REPORT_HISTORIC_POINT;
+    client.historicPointsSent += pointsInBatch;
+    return packetWriteIndex;
+}
+
+// 0x95：以差值/run-length 壓縮 (格式見 history_codec.h)，一包放滿該連線 MTU 能容納的紀錄
+static int fillCompactHistoricBlock(BleClient& client, uint8_t* blockPacket) {
+    HistoryBlockEncoder enc;
+    size_t capacity = min(client.mtu - 3, BLE_NOTIFY_MAX_LENGTH);
+    historyBlockBegin(enc, blockPacket, capacity, CMD_REPORT_HISTORIC_BLOCK, client.historicBlockSeq, historyRecordInterval / 1000);
+    while (client.historicIndex < historyCount) {
+        DataPoint dp;
+        if (!readHistoricPoint(client, client.historicIndex, dp)) return -1;
+        if (!isnan(dp.temp) && dp.time != 0 && dp.time > client.historicSince) {
+            if (!historyBlockAdd(enc, dp.time, (int16_t)lroundf(dp.temp * 10), (uint8_t)lroundf(dp.hum))) break; // 區塊已滿，這筆放下一包
+            client.historicCursor = max(client.historicCursor, dp.time);
+        }
+        client.historicIndex++;
     }
-    if (historicDataIndexToSend >= historyCount) {
-        historyFile.close();
+    if (enc.count == 0) return 0;
+    client.historicBlockSeq++;
+    client.historicPointsSent += enc.count;
+    return enc.length;
+}
+
+// 每次最多放入一包，且只在該連線的 notify 佇列有空間時；各連線的佇列由 handleNotifyQueue() 輪流送出，
+// 一個連線的完整匯出不會擋住另一個連線的即時數據
+static void transferHistoricData(BleClient& client) {
+    if (notifyQueueFree(currentClient) <= BLE_NOTIFY_RESERVED_SLOTS) return; // 等佇列消化，不讓大量傳輸擠掉其他回報
+    static uint8_t batchPacket[BLE_NOTIFY_MAX_LENGTH];
+    int packetLength = client.historicCompact ? fillCompactHistoricBlock(client, batchPacket) : fillHistoricBatch(client, batchPacket);
+    if (packetLength < 0) {
+        Serial.println("DEBUG: Failed to read history for transfer.");
+        sendErrorReport(0x04);
+        client.sendingHistoric = false;
+        return;
+    }
+    if (packetLength > 0) {
+        queueNotify(batchPacket, packetLength);
+        client.historicBytesSent += packetLength;
+        client.historicPacketsSent++;
+    }
+    if (client.historicIndex >= historyCount) {
         sendHistoricDataEnd();
-        isSendingHistoricData = false;
-        unsigned long duration = millis() - historicDataStartTime;
-        Serial.printf("Historic data transfer finished in %lu ms.\n", duration);
+        client.sendingHistoric = false;
+        unsigned long duration = millis() - client.historicStartTime;
+        float seconds = max(duration, 1UL) / 1000.0;
+        Serial.printf("Historic data transfer (%s) to client %d finished in %lu ms: %lu points in %lu packets / %lu bytes (MTU %u), %.1f points/s, %.0f bytes/s.\n",
+                      client.historicCompact ? "compact" : "batch", currentClient, duration, (unsigned long)client.historicPointsSent, (unsigned long)client.historicPacketsSent,
+                      (unsigned long)client.historicBytesSent, client.mtu, client.historicPointsSent / seconds, client.historicBytesSent / seconds);
     }
 }
 
+void handleHistoricDataTransfer() {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (!clients[i].active || !clients[i].sendingHistoric) continue;
+        currentClient = i;
+        transferHistoricData(clients[i]);
+    }
+    currentClient = -1;
+}
+
 
 void sendTimeSyncAck() {
     if (!bleDeviceConnected) return;
     // Serial.println("DEBUG: Sending Time Sync ACK.");
     uint8_t packet[1] = {CMD_TIME_SYNC_ACK};
-    pDataEventCharacteristic->setValue(packet, 1);
-    pDataEventCharacteristic->notify();
+    queueNotify(packet, 1);
 }
 
 void sendErrorReport(uint8_t errorCode) {
     if (!bleDeviceConnected) return;
     Serial.printf("DEBUG: Sending error report with code 0x%02X.\n", errorCode);
     uint8_t packet[2] = {CMD_ERROR, errorCode};
-    pDataEventCharacteristic->setValue(packet, 2);
-    pDataEventCharacteristic->notify();
+    queueNotify(packet, 2);
 }
 
-void handleRealtimeData() {
-    if (isRealtimeEnabled && bleDeviceConnected && (millis() - lastRealtimeSend > REALTIME_INTERVAL)) {
-        lastRealtimeSend = millis();
+// 待送的樣本在最短間隔後送出；數值一直沒超過門檻時，最長間隔到了仍重送一次讓 App 知道連線正常
+static void handleClientRealtime(BleClient& client) {
+    unsigned long elapsed = millis() - client.realtimeLastSend;
+    if (client.realtimeHasSent && elapsed < client.realtimeMinInterval) return;
+    if (client.realtimePending || (client.realtimeMaxInterval > 0 && elapsed >= client.realtimeMaxInterval)) {
         sendRealtimeSensorData();
     }
 }
+
+// 感測器讀到新樣本時呼叫 (hardware.cpp)：與各連線上次送出的數值相比超過門檻才標記為待送
+void handleRealtimeSample() {
+    int16_t temp = lroundf(cachedTemp * 10);
+    int16_t hum = lroundf(cachedHum);
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        BleClient& client = clients[i];
+        if (!client.active || !client.realtimeEnabled) continue;
+        // 門檻為 0 的欄位不觸發 (只設溫度門檻時濕度不會讓每個樣本都送出)；兩者皆為 0 = 每個新樣本都送
+        uint8_t tempThreshold = client.realtimeTempThreshold, humThreshold = client.realtimeHumThreshold;
+        bool changed = (tempThreshold == 0 && humThreshold == 0) ||
+                       (tempThreshold > 0 && abs(temp - client.realtimeLastTemp) >= tempThreshold) ||
+                       (humThreshold > 0 && abs(hum - client.realtimeLastHum) >= humThreshold);
+        if (!client.realtimeHasSent || changed) client.realtimePending = true;
+    }
+    handleRealtimeData();
+}
+
+void handleRealtimeData() {
+    int previous = currentClient;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (!clients[i].active || !clients[i].realtimeEnabled) continue;
+        currentClient = i;
+        handleClientRealtime(clients[i]);
+    }
+    currentClient = previous;
+}
+
+static void transferRollup(BleClient& client) {
+    if (notifyQueueFree(currentClient) <= BLE_NOTIFY_RESERVED_SLOTS) return;
+    int reads = 0;
+    while (true) {
+        if (client.rollupReadPos >= client.rollupReadCount) {
+            if (client.rollupLeft == 0) break;
+            // 稀疏的時段可能連續好幾批都是空的：每次最多讀取幾批就讓出 loop，下次再繼續
+            if (reads++ == ROLLUP_TRANSFER_MAX_READS) return;
+            int n = min(client.rollupLeft, 16);
+            uint32_t p = rollupPeriod(client.rollupTier);
+            client.rollupReadCount = readRollupRange(client.rollupTier, client.rollupNextTime + (n - 1) * p, n, client.rollupReadBuffer);
+            client.rollupReadPos = 0;
+            client.rollupNextTime += n * p;
+            client.rollupLeft -= n;
+        }
+        const RollupBucket& b = client.rollupReadBuffer[client.rollupReadPos++];
+        if (b.count == 0) continue;
+        // start(4) count(2) tempMin/Max/Mean(2x3) humMin/Max/Mean(2x3)，溫濕度 x100
+        uint8_t packet[19];
+        packet[0] = CMD_REPORT_ROLLUP;
+        memcpy(&packet[1], &b.start, 4);
+        memcpy(&packet[5], &b.count, 2);
+        memcpy(&packet[7], &b.tempMin, 6);
+        memcpy(&packet[13], &b.humMin, 6);
+        queueNotify(packet, sizeof(packet));
+        client.rollupSent++;
+        return;
+    }
+    uint8_t packet[4] = {CMD_REPORT_ROLLUP_END, (uint8_t)client.rollupTier, (uint8_t)(client.rollupSent & 0xFF), (uint8_t)(client.rollupSent >> 8)};
+    queueNotify(packet, sizeof(packet));
+    client.sendingRollup = false;
+    Serial.printf("Rollup transfer to client %d finished, %d buckets sent.\n", currentClient, client.rollupSent);
+}
+
+void handleRollupTransfer() {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (!clients[i].active || !clients[i].sendingRollup) continue;
+        currentClient = i;
+        transferRollup(clients[i]);
+    }
+    currentClient = -1;
+}
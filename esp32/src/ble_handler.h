@@ -4,7 +4,12 @@
 #include <Arduino.h>
 
 void setupBLE();
+int getBleClient();
+bool isBleClientConnected(int client);
+uint16_t getBleClientConnId(int client);
+uint16_t getBleMtu();
 void handleCommand(uint8_t* data, size_t length);
+void handleBleCommands();
 void sendBoxStatus();
 void sendMedicationTaken(uint8_t slot);
 void sendSensorDataReport();
@@ -13,4 +18,6 @@ void sendHistoricDataEnd();
 void sendTimeSyncAck();
 void sendErrorReport(uint8_t errorCode);
 void handleHistoricDataTransfer();
+void handleRollupTransfer();
 void handleRealtimeData();
+void handleRealtimeSample();
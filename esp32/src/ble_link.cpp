@@ -0,0 +1,144 @@
+#include "globals.h"
+#include "ble_link.h"
+#include <BLEDevice.h>
+#include <esp_gap_ble_api.h>
+
+// Pre-declare functions from other modules that are used here
+bool isBleClientConnected(int client);
+bool isBleClientBusy(int client);
+uint32_t getBleClientRxBytes(int client);
+uint32_t notifyBytesSent(int client);
+
+// ==================== 連線參數組合 ====================
+// 裝置不主動要求時，連線間隔由手機決定：對大量傳輸太慢，App 只是開著時又太耗電。
+// 每個連線依目前的工作切換參數組合：
+//   BULK - 歷史/彙總傳輸或 OTA 進行中：短間隔、不使用 latency，並要求 2M PHY (晶片支援 BLE 5 時)
+//   IDLE - 連線建立或大量傳輸結束 BLE_CONN_IDLE_DELAY_MS 後：長間隔加 slave latency，PHY 回到 1M 以維持距離
+// 參數只是向手機提出的要求，手機實際採用的值由 GAP 事件回報並記錄在 log。
+// 每次切換時記錄上一個組合的持續時間與收發量 (bytes/s)，並累計到 bleLinkStats 以比較各組合的實際吞吐量。
+struct LinkState {
+    esp_bd_addr_t bda;
+    BleLinkProfile profile = BLE_PROFILE_DEFAULT;
+    unsigned long profileSince = 0;     // 進入目前組合的時間
+    uint32_t bytesAtSwitch = 0;         // 進入目前組合時的收發量
+    unsigned long lastBusy = 0;         // 最後一次有大量傳輸的時間
+    volatile uint16_t interval = 0;     // 手機採用的連線間隔 (1.25 ms)，0 = 未回報
+    volatile uint16_t latency = 0;
+    volatile uint8_t txPhy = 1;
+};
+static LinkState links[BLE_MAX_CONNECTIONS];
+
+static const char* const PROFILE_NAMES[BLE_PROFILE_COUNT] = {"default", "bulk", "idle"};
+
+static int findLink(const esp_bd_addr_t bda) {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (isBleClientConnected(i) && memcmp(links[i].bda, bda, sizeof(esp_bd_addr_t)) == 0) return i;
+    }
+    return -1;
+}
+
+// BLE task 中執行：記錄手機實際採用的參數
+static void gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
+    if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT) {
+        int client = findLink(param->update_conn_params.bda);
+        if (client < 0) return;
+        if (param->update_conn_params.status != ESP_BT_STATUS_SUCCESS) {
+            Serial.printf("DEBUG: BLE client %d connection parameter update failed (%d)\n", client, param->update_conn_params.status);
+            return;
+        }
+        links[client].interval = param->update_conn_params.conn_int;
+        links[client].latency = param->update_conn_params.latency;
+        Serial.printf("DEBUG: BLE client %d connection interval %.2f ms, latency %u, timeout %u ms\n", client,
+                      param->update_conn_params.conn_int * 1.25, param->update_conn_params.latency, param->update_conn_params.timeout * 10);
+    }
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    else if (event == ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT) {
+        int client = findLink(param->phy_update.bda);
+        if (client < 0 || param->phy_update.status != ESP_BT_STATUS_SUCCESS) return;
+        links[client].txPhy = param->phy_update.tx_phy;
+        Serial.printf("DEBUG: BLE client %d PHY tx %uM / rx %uM\n", client, param->phy_update.tx_phy, param->phy_update.rx_phy);
+    }
+#endif
+}
+
+void setupLinkProfiles() {
+    BLEDevice::setCustomGapHandler(gapEventHandler);
+}
+
+static uint32_t linkBytes(int client) {
+    return getBleClientRxBytes(client) + notifyBytesSent(client);
+}
+
+// 結算目前組合的持續時間與收發量
+static void accountLinkProfile(int client, const char* reason) {
+    LinkState& link = links[client];
+    unsigned long duration = millis() - link.profileSince;
+    uint32_t bytes = linkBytes(client) - link.bytesAtSwitch;
+    bleLinkStats.profileMillis[link.profile] += duration;
+    bleLinkStats.profileBytes[link.profile] += bytes;
+    Serial.printf("DEBUG: BLE client %d %s: %s profile for %lu ms, %lu bytes, %.0f bytes/s (interval %.2f ms, latency %u, PHY %uM)\n",
+                  client, reason, PROFILE_NAMES[link.profile], duration, (unsigned long)bytes, bytes * 1000.0 / max(duration, 1UL),
+                  link.interval * 1.25, link.latency, link.txPhy);
+}
+
+static void applyLinkProfile(int client, BleLinkProfile profile) {
+    LinkState& link = links[client];
+    accountLinkProfile(client, "switching");
+    link.profile = profile;
+    link.profileSince = millis();
+    link.bytesAtSwitch = linkBytes(client);
+    bleLinkStats.profileSwitches++;
+
+    bool bulk = profile == BLE_PROFILE_BULK;
+    esp_ble_conn_update_params_t params;
+    memcpy(params.bda, link.bda, sizeof(esp_bd_addr_t));
+    params.min_int = bulk ? BLE_CONN_BULK_MIN_INTERVAL : BLE_CONN_IDLE_MIN_INTERVAL;
+    params.max_int = bulk ? BLE_CONN_BULK_MAX_INTERVAL : BLE_CONN_IDLE_MAX_INTERVAL;
+    params.latency = bulk ? BLE_CONN_BULK_LATENCY : BLE_CONN_IDLE_LATENCY;
+    params.timeout = bulk ? BLE_CONN_BULK_TIMEOUT : BLE_CONN_IDLE_TIMEOUT;
+    esp_err_t err = esp_ble_gap_update_conn_params(&params);
+    Serial.printf("DEBUG: BLE client %d -> %s profile (interval %.2f-%.2f ms, latency %u)%s\n", client, PROFILE_NAMES[profile],
+                  params.min_int * 1.25, params.max_int * 1.25, params.latency, err == ESP_OK ? "" : ", request failed");
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    esp_ble_gap_phy_mask_t phy = bulk ? ESP_BLE_GAP_PHY_2M_PREF_MASK : ESP_BLE_GAP_PHY_1M_PREF_MASK;
+    err = esp_ble_gap_set_preferred_phy(link.bda, 0, phy, phy, ESP_BLE_GAP_PHY_OPTIONS_NO_PREF); // all_phys 0 = TX/RX 皆依偏好
+    if (err != ESP_OK) Serial.printf("DEBUG: BLE client %d PHY request failed (%d)\n", client, err);
+#endif
+}
+
+// 連線建立時 (main task)：沿用手機的參數，閒置一段時間後才切換，不拖慢連線初期的 MTU 交換與設定
+void openLinkProfile(int client, const uint8_t* bda) {
+    LinkState& link = links[client];
+    link = LinkState();
+    memcpy(link.bda, bda, sizeof(esp_bd_addr_t));
+    link.profileSince = link.lastBusy = millis();
+    link.bytesAtSwitch = linkBytes(client);
+}
+
+// 斷線時結算，並列出開機以來各組合的平均吞吐量
+void closeLinkProfile(int client) {
+    accountLinkProfile(client, "disconnected");
+    Serial.printf("DEBUG: BLE profile stats - %u switches", bleLinkStats.profileSwitches);
+    for (int i = 0; i < BLE_PROFILE_COUNT; i++) {
+        unsigned long ms = bleLinkStats.profileMillis[i];
+        Serial.printf(", %s %lu bytes in %lu ms (%.0f bytes/s)", PROFILE_NAMES[i], (unsigned long)bleLinkStats.profileBytes[i], ms,
+                      bleLinkStats.profileBytes[i] * 1000.0 / max(ms, 1UL));
+    }
+    Serial.println();
+}
+
+// loop() 中呼叫
+void handleLinkProfiles() {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (!isBleClientConnected(i)) continue;
+        LinkState& link = links[i];
+        BleLinkProfile profile = link.profile;
+        if (isBleClientBusy(i)) {
+            link.lastBusy = millis();
+            profile = BLE_PROFILE_BULK;
+        } else if (millis() - link.lastBusy >= BLE_CONN_IDLE_DELAY_MS) {
+            profile = BLE_PROFILE_IDLE;
+        }
+        if (profile != link.profile) applyLinkProfile(i, profile);
+    }
+}
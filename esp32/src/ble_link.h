@@ -0,0 +1,8 @@
+#pragma once
+
+#include <Arduino.h>
+
+void setupLinkProfiles();
+void openLinkProfile(int client, const uint8_t* bda);
+void closeLinkProfile(int client);
+void handleLinkProfiles();
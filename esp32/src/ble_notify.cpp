@@ -0,0 +1,278 @@
+#include "globals.h"
+#include "ble_notify.h"
+#include <esp_gatts_api.h>
+#include <atomic>
+
+// Pre-declare functions from other modules that are used here
+int getBleClient();
+bool isBleClientConnected(int client);
+uint16_t getBleClientConnId(int client);
+
+// ==================== Notify 傳送佇列 ====================
+// 所有 send*() 只把封包放進佇列，由 loop() 呼叫 handleNotifyQueue() 送出：
+//   - 每個連線各有一個佇列，回報只放進目前處理中的連線 (getBleClient())，-1 時放進所有連線
+//   - 各連線的佇列輪流送出一包，一個連線的大量傳輸不會擋住其他連線的即時數據
+//   - BLE 堆疊回報某連線壅塞 (ESP_GATTS_CONGEST_EVT) 時只暫停該連線，解除後再繼續
+//   - 只送給在 CCCD 開啟 notify 的連線；BLE2902 的值由所有連線共用，因此在 ESP_GATTS_WRITE_EVT 中依 conn_id 記錄
+//   - notify 失敗 (控制器緩衝已滿) 時保留在佇列，稍後重試，超過次數才丟棄
+//   - 會被新值取代的回報 (環境數據、狀態、OTA ACK) 若還在佇列中，直接以新內容覆蓋，不重複送出
+// 佇列只由 main task 存取；BLE task 只更新壅塞旗標。
+// Arduino 的 BLECharacteristic::notify() 會送給所有連線，因此改以 esp_ble_gatts_send_indicate() 指定 conn_id。
+struct NotifySlot {
+    uint16_t length;
+    uint8_t data[BLE_NOTIFY_MAX_LENGTH];
+};
+struct NotifyQueue {
+    NotifySlot slots[BLE_NOTIFY_QUEUE_SLOTS];
+    int head = 0;                 // 下一個放入的 slot
+    int count = 0;
+    uint8_t retries = 0;          // 佇列最前面的封包已重試的次數
+    unsigned long retryAt = 0;    // 重試前要等到的時間
+    uint32_t bytesSent = 0;       // 累計送出的 bytes (吞吐量統計，不歸零)
+};
+static NotifyQueue notifyQueues[BLE_MAX_CONNECTIONS];
+static int notifyNextClient = 0;  // 下一輪先送的連線
+static std::atomic<uint32_t> congestedConns(0); // bit = conn_id
+static std::atomic<uint32_t> subscribedConns(0); // bit = conn_id，已在 CCCD 開啟 notify
+static volatile esp_gatt_if_t notifyGattsIf = ESP_GATT_IF_NONE;
+static BLECharacteristic* notifyCharacteristic = nullptr;
+static BLEDescriptor* notifyCccd = nullptr;
+// 批次指令執行期間，回報先收集成一個 [opcode, frame] + ([長度, 回報])* 的封包，結束時一次送出
+static bool batchActive = false;
+static int batchClient = -1;
+static uint8_t batchFrame[BLE_NOTIFY_MAX_LENGTH];
+static size_t batchCapacity = 0;
+static size_t batchLength = 0;
+static uint8_t batchFrameIndex = 0;
+
+static void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t* param) {
+    if (event == ESP_GATTS_CONNECT_EVT) {
+        notifyGattsIf = gattsIf;
+        if (param->connect.conn_id < 32) subscribedConns &= ~(1UL << param->connect.conn_id);
+    } else if (event == ESP_GATTS_WRITE_EVT && notifyCccd && param->write.handle == notifyCccd->getHandle() &&
+               param->write.len == 2 && param->write.conn_id < 32) {
+        uint32_t bit = 1UL << param->write.conn_id;
+        if (param->write.value[0] & 0x01) {
+            subscribedConns |= bit;
+        } else {
+            subscribedConns &= ~bit;
+        }
+    } else if (event == ESP_GATTS_CONGEST_EVT && param->congest.conn_id < 32) {
+        uint32_t bit = 1UL << param->congest.conn_id;
+        if (param->congest.congested) {
+            congestedConns |= bit;
+            bleLinkStats.congestionEvents++;
+        } else {
+            congestedConns &= ~bit;
+        }
+    }
+}
+
+void setupNotifyQueue(BLECharacteristic* characteristic) {
+    notifyCharacteristic = characteristic;
+    notifyCccd = characteristic->getDescriptorByUUID(BLEUUID((uint16_t)0x2902));
+    BLEDevice::setCustomGattsHandler(gattsEventHandler);
+}
+
+// 新的內容會完整取代舊內容的回報：同一 opcode 只需保留最新的一筆
+static bool isSupersedable(uint8_t opcode) {
+    switch (opcode) {
+        case CMD_REPORT_STATUS:
+        case CMD_REPORT_ENG_MODE_STATUS:
+        case CMD_REPORT_ENV:
+        case CMD_REPORT_OTA_ACK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool queuePacket(int client, const uint8_t* data, size_t length);
+
+// 送出目前的 frame (最高位元為 0 = 後面還有) 並開新的 frame；frame 中沒有回報時不送
+static bool flushBatch() {
+    if (batchLength <= 2) return true;
+    bool ok = queuePacket(batchClient, batchFrame, batchLength);
+    batchFrame[1] = ++batchFrameIndex & 0x7F;
+    batchLength = 2;
+    return ok;
+}
+
+static bool appendToBatch(const uint8_t* data, size_t length) {
+    if (2 + 1 + length > batchCapacity) {
+        // 單獨放不進一個 frame：先送出前面已放進 frame 的回報，維持回報順序，再照常送出
+        flushBatch();
+        return queuePacket(batchClient, data, length);
+    }
+    if (batchLength + 1 + length > batchCapacity && !flushBatch()) return false;
+    batchFrame[batchLength++] = length;
+    memcpy(&batchFrame[batchLength], data, length);
+    batchLength += length;
+    return true;
+}
+
+// 批次屬於目前處理中的連線
+void beginNotifyBatch(uint8_t opcode, size_t capacity) {
+    batchActive = true;
+    batchClient = getBleClient();
+    batchCapacity = min(capacity, (size_t)BLE_NOTIFY_MAX_LENGTH);
+    batchFrameIndex = 0;
+    batchFrame[0] = opcode;
+    batchFrame[1] = 0;
+    batchLength = 2;
+}
+
+// 送出最後一個 frame (frame 序號最高位元 = 1)，沒有任何回報時也送出，讓 App 知道批次已執行完
+void endNotifyBatch() {
+    if (!batchActive) return;
+    batchActive = false;
+    batchFrame[1] |= 0x80;
+    queuePacket(batchClient, batchFrame, batchLength);
+}
+
+bool queueNotifyTo(int client, const uint8_t* data, size_t length) {
+    if (!isBleClientConnected(client) || length == 0) return false;
+    if (batchActive && client == batchClient) return appendToBatch(data, length);
+    return queuePacket(client, data, length);
+}
+
+bool queueNotify(const uint8_t* data, size_t length) {
+    int client = getBleClient();
+    if (client >= 0) return queueNotifyTo(client, data, length);
+    bool queued = false;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (queueNotifyTo(i, data, length)) queued = true;
+    }
+    return queued;
+}
+
+static bool queuePacket(int client, const uint8_t* data, size_t length) {
+    if (!isBleClientConnected(client) || length == 0) return false;
+    if (length > BLE_NOTIFY_MAX_LENGTH) {
+        Serial.printf("ERROR: Notification 0x%02X too long (%u bytes), dropped.\n", data[0], length);
+        bleLinkStats.notificationsDropped++;
+        return false;
+    }
+    NotifyQueue& q = notifyQueues[client];
+    if (isSupersedable(data[0])) {
+        // 正在重試的最前面一筆不覆蓋，避免重送的內容與失敗的那次不同
+        for (int i = q.retries > 0 ? 1 : 0; i < q.count; i++) {
+            NotifySlot& slot = q.slots[(q.head - q.count + i + BLE_NOTIFY_QUEUE_SLOTS) % BLE_NOTIFY_QUEUE_SLOTS];
+            if (slot.data[0] == data[0] && slot.length == length) {
+                memcpy(slot.data, data, length);
+                bleLinkStats.notificationsCoalesced++;
+                return true;
+            }
+        }
+    }
+    if (q.count == BLE_NOTIFY_QUEUE_SLOTS) {
+        Serial.printf("ERROR: Notify queue of client %d full, 0x%02X dropped.\n", client, data[0]);
+        bleLinkStats.notificationsDropped++;
+        return false;
+    }
+    NotifySlot& slot = q.slots[q.head];
+    slot.length = length;
+    memcpy(slot.data, data, length);
+    q.head = (q.head + 1) % BLE_NOTIFY_QUEUE_SLOTS;
+    q.count++;
+    if (q.count > bleLinkStats.notifyQueuePeak) bleLinkStats.notifyQueuePeak = q.count;
+    return true;
+}
+
+// 大量傳輸 (歷史、彙總) 在放入下一包前檢查，保留空間給 ACK 與錯誤回報
+int notifyQueueFree(int client) {
+    return BLE_NOTIFY_QUEUE_SLOTS - notifyQueues[client].count;
+}
+
+static void popNotify(NotifyQueue& q) {
+    q.count--;
+    q.retries = 0;
+}
+
+// 送出該連線佇列最前面的一包；回傳 false 表示這一輪不能再送 (空的、壅塞或等待重試)
+static bool sendNextNotify(int client) {
+    NotifyQueue& q = notifyQueues[client];
+    if (q.count == 0) return false;
+    uint16_t connId = getBleClientConnId(client);
+    if (connId < 32 && !(subscribedConns & (1UL << connId))) {
+        // App 未訂閱：佇列中的封包全部丟棄並計數
+        bleLinkStats.notificationsDropped += q.count;
+        q.count = 0;
+        q.retries = 0;
+        return false;
+    }
+    if ((connId < 32 && (congestedConns & (1UL << connId))) || (q.retries > 0 && (long)(millis() - q.retryAt) < 0)) return false;
+    NotifySlot& slot = q.slots[(q.head - q.count + BLE_NOTIFY_QUEUE_SLOTS) % BLE_NOTIFY_QUEUE_SLOTS];
+    esp_err_t err = esp_ble_gatts_send_indicate(notifyGattsIf, connId, notifyCharacteristic->getHandle(), slot.length, slot.data, false);
+    if (err == ESP_OK) {
+        bleLinkStats.notificationsSent++;
+        q.bytesSent += slot.length;
+        popNotify(q);
+        return true;
+    }
+    // 控制器緩衝已滿：留在佇列最前面，稍後重試
+    bleLinkStats.notificationRetries++;
+    if (++q.retries > BLE_NOTIFY_MAX_RETRIES) {
+        Serial.printf("ERROR: Notification 0x%02X to client %d failed %d times, dropped.\n", slot.data[0], client, BLE_NOTIFY_MAX_RETRIES);
+        bleLinkStats.notificationsDropped++;
+        popNotify(q);
+    } else {
+        q.retryAt = millis() + BLE_NOTIFY_RETRY_MS;
+    }
+    return false;
+}
+
+void handleNotifyQueue() {
+    int sent = 0;
+    bool progress = true;
+    while (sent < BLE_NOTIFY_BURST && progress) {
+        progress = false;
+        for (int i = 0; i < BLE_MAX_CONNECTIONS && sent < BLE_NOTIFY_BURST; i++) {
+            int client = (notifyNextClient + i) % BLE_MAX_CONNECTIONS;
+            if (!isBleClientConnected(client)) continue;
+            if (sendNextNotify(client)) {
+                sent++;
+                progress = true;
+            }
+        }
+    }
+    notifyNextClient = (notifyNextClient + 1) % BLE_MAX_CONNECTIONS; // 每次 loop 換一個連線先送
+}
+
+uint32_t notifyBytesSent(int client) {
+    return notifyQueues[client].bytesSent;
+}
+
+static bool notifyQueuesPending() {
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (isBleClientConnected(i) && notifyQueues[i].count > 0) return true;
+    }
+    return false;
+}
+
+// 重新開機前等所有連線的佇列送完 (例如 OTA 結果)
+void flushNotifyQueue(unsigned long timeoutMs) {
+    unsigned long start = millis();
+    while (notifyQueuesPending() && millis() - start < timeoutMs) {
+        handleNotifyQueue();
+        delay(5);
+    }
+}
+
+// 連線建立與中斷時清空該連線的佇列
+void clearNotifyQueue(int client) {
+    NotifyQueue& q = notifyQueues[client];
+    bleLinkStats.notificationsDropped += q.count;
+    q.count = 0;
+    q.retries = 0;
+    uint16_t connId = getBleClientConnId(client);
+    if (connId < 32) congestedConns &= ~(1UL << connId);
+}
+
+void logBleLinkStats() {
+    Serial.printf("DEBUG: BLE link stats - commands %lu (dropped %lu, peak %u), notifications sent %lu, coalesced %lu, dropped %lu, retries %lu, congestion %lu (peak queue %u), peak clients %u\n",
+                  (unsigned long)bleLinkStats.commandsReceived, (unsigned long)bleLinkStats.commandsDropped, bleLinkStats.commandQueuePeak,
+                  (unsigned long)bleLinkStats.notificationsSent, (unsigned long)bleLinkStats.notificationsCoalesced,
+                  (unsigned long)bleLinkStats.notificationsDropped, (unsigned long)bleLinkStats.notificationRetries,
+                  (unsigned long)bleLinkStats.congestionEvents, bleLinkStats.notifyQueuePeak, bleLinkStats.clientsPeak);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+
+bool queueNotify(const uint8_t* data, size_t length);
+bool queueNotifyTo(int client, const uint8_t* data, size_t length);
+void beginNotifyBatch(uint8_t opcode, size_t capacity);
+void endNotifyBatch();
+int notifyQueueFree(int client);
+void handleNotifyQueue();
+void flushNotifyQueue(unsigned long timeoutMs);
+void clearNotifyQueue(int client);
+void setupNotifyQueue(BLECharacteristic* characteristic);
+uint32_t notifyBytesSent(int client);
+void logBleLinkStats();
@@ -0,0 +1,445 @@
+#include "globals.h"
+#include "ble_ota.h"
+#include "ble_notify.h"
+#include <Update.h>
+#include <esp_rom_crc.h>
+
+// Pre-declare functions from other modules that are used here
+void drawOtaScreen(const char* text, int progress = -1);
+void updateScreens();
+uint16_t getBleMtu();
+int getBleClient();
+
+// ==================== 視窗式 BLE OTA ====================
+// App 以 CMD_OTA_BEGIN 告知總大小與 CRC32，裝置回 CMD_REPORT_OTA_READY (續傳位置、chunk 大小、視窗)。
+// 之後 App 可連續送出 window 個 CMD_OTA_CHUNK (write without response)，每個 chunk 帶 seq 與 offset：
+// offset = 續傳位置 + seq * chunkSize。寫入位置只由 offset 決定；seq 只是 chunk 序號的低 16 位元，
+// 超過 65535 個 chunk 時會繞回，僅用來核對。
+// 依序到達的 chunk 直接寫入 flash，超前的 chunk 先放進視窗緩衝，補齊缺口後再一起寫入。
+// 裝置以 CMD_REPORT_OTA_ACK 回報下一個需要的 seq 與其後已收到的 chunk (bitmap)，App 只需重送缺少的部分。
+// 斷線時保留進度 (Update 不中止)，重新連線後以相同的大小與 CRC32 再送一次 BEGIN 即從已寫入的位置續傳。
+// 全部寫入後 CMD_OTA_FINISH 比對整個映像的 CRC32，相符才 Update.end() 並重新開機。
+enum OtaResult : uint8_t {
+    OTA_RESULT_OK = 0,
+    OTA_RESULT_INCOMPLETE = 1,
+    OTA_RESULT_CRC_MISMATCH = 2,
+    OTA_RESULT_FLASH_ERROR = 3,
+    OTA_RESULT_NO_SESSION = 4,
+    OTA_RESULT_MTU_TOO_SMALL = 5,
+};
+
+static bool otaWindowed = false;         // 目前的 session 是否為視窗式 (可續傳)
+static uint32_t otaExpectedCrc = 0;
+static uint32_t otaCrc = 0;              // 已寫入部分的 CRC32
+static uint32_t otaBaseOffset = 0;       // seq 0 對應的 offset (READY 時的續傳位置)
+static uint16_t otaChunkSize = 0;
+static uint8_t otaWindow = 0;
+static uint16_t otaNextSeq = 0;          // 下一個要寫入 flash 的 seq (低 16 位元，位置以 otaBytesReceived 為準)
+static uint16_t otaChunksSinceAck = 0;
+static bool otaGapReported = false;      // 目前的缺口已回報過，避免每個超前 chunk 都送 ACK
+static unsigned long otaLastActivity = 0;
+static int otaShownProgress = -1;
+static int otaClient = -1;               // session 所屬的連線；-1 = 斷線暫停中，任何連線都可以續傳
+static uint8_t otaWindowBuffer[BLE_OTA_MAX_WINDOW][BLE_OTA_MAX_CHUNK];
+static uint16_t otaWindowLength[BLE_OTA_MAX_WINDOW]; // 0 = 空
+static uint32_t otaWindowOffset[BLE_OTA_MAX_WINDOW];
+
+static void notifyPacket(uint8_t* packet, size_t length) {
+    queueNotify(packet, length);
+}
+
+static void showOtaProgress() {
+    int progress = otaTotalSize ? (int)((uint64_t)otaBytesReceived * 100 / otaTotalSize) : 0;
+    if (progress == otaShownProgress) return;
+    otaShownProgress = progress;
+    char text[24];
+    snprintf(text, sizeof(text), "BLE %d%%", progress);
+    drawOtaScreen(text, progress);
+}
+
+static void endOtaSession() {
+    isBleOtaInProgress = false;
+    otaWindowed = false;
+    otaShownProgress = -1;
+}
+
+static void sendOtaReady() {
+    uint8_t packet[10] = {CMD_REPORT_OTA_READY};
+    uint32_t offset = otaBytesReceived;
+    memcpy(&packet[1], &offset, 4);
+    memcpy(&packet[5], &otaNextSeq, 2);
+    memcpy(&packet[7], &otaChunkSize, 2);
+    packet[9] = otaWindow;
+    notifyPacket(packet, sizeof(packet));
+}
+
+static void sendOtaAck() {
+    // bitmap 第 i 位 = seq (otaNextSeq + 1 + i) 已在視窗緩衝中
+    uint16_t bitmap = 0;
+    for (int i = 0; i < otaWindow; i++) {
+        if (otaWindowLength[i] == 0 || otaWindowOffset[i] <= otaBytesReceived) continue;
+        uint32_t ahead = (otaWindowOffset[i] - otaBytesReceived) / otaChunkSize;
+        if (ahead <= 16) bitmap |= 1 << (ahead - 1);
+    }
+    uint8_t packet[9] = {CMD_REPORT_OTA_ACK};
+    uint32_t offset = otaBytesReceived;
+    memcpy(&packet[1], &otaNextSeq, 2);
+    memcpy(&packet[3], &offset, 4);
+    memcpy(&packet[7], &bitmap, 2);
+    notifyPacket(packet, sizeof(packet));
+    otaChunksSinceAck = 0;
+}
+
+static void sendOtaResult(OtaResult result) {
+    uint8_t packet[10] = {CMD_REPORT_OTA_RESULT, result};
+    uint32_t offset = otaBytesReceived;
+    memcpy(&packet[2], &offset, 4);
+    memcpy(&packet[6], &otaCrc, 4);
+    notifyPacket(packet, sizeof(packet));
+}
+
+static bool writeOtaData(uint8_t* data, size_t length) {
+    if (Update.write(data, length) != length) {
+        Serial.println("ERROR: OTA data write failed!");
+        Update.printError(Serial);
+        return false;
+    }
+    otaCrc = esp_rom_crc32_le(otaCrc, data, length);
+    otaBytesReceived += length;
+    otaNextSeq++;
+    otaChunksSinceAck++;
+    return true;
+}
+
+static void handleOtaBegin(uint8_t* data, size_t length) {
+    if (length < 9) {
+        sendErrorReport(0x05);
+        return;
+    }
+    uint32_t totalSize, crc;
+    memcpy(&totalSize, &data[1], 4);
+    memcpy(&crc, &data[5], 4);
+    uint16_t chunk = BLE_OTA_MAX_CHUNK;
+    uint8_t window = BLE_OTA_MAX_WINDOW;
+    if (length >= 11) memcpy(&chunk, &data[9], 2);
+    if (length >= 12) window = data[11];
+    // chunk 必須放得進一次寫入 (MTU - 3 的 ATT 標頭 - 7 的 chunk 標頭)；連最小的 chunk 都放不下時拒絕 (App 需先交換 MTU)
+    int maxChunk = min(BLE_OTA_MAX_CHUNK, (int)getBleMtu() - 3 - 7);
+    if (maxChunk < BLE_OTA_MIN_CHUNK) {
+        Serial.printf("ERROR: MTU %u too small for BLE OTA.\n", getBleMtu());
+        sendOtaResult(OTA_RESULT_MTU_TOO_SMALL);
+        return;
+    }
+    chunk = constrain((int)chunk, BLE_OTA_MIN_CHUNK, maxChunk);
+    window = constrain((int)window, 1, BLE_OTA_MAX_WINDOW);
+
+    bool resume = isBleOtaInProgress && otaWindowed && totalSize == otaTotalSize && crc == otaExpectedCrc;
+    if (!resume) {
+        if (isBleOtaInProgress) Update.abort();
+        Serial.printf("DEBUG: CMD_OTA_BEGIN received. Total size: %lu bytes, CRC32 %08lX\n", (unsigned long)totalSize, (unsigned long)crc);
+        if (!Update.begin(totalSize)) {
+            Serial.println("ERROR: Not enough space to begin OTA");
+            Update.printError(Serial);
+            endOtaSession();
+            sendOtaResult(OTA_RESULT_FLASH_ERROR);
+            return;
+        }
+        otaTotalSize = totalSize;
+        otaExpectedCrc = crc;
+        otaBytesReceived = 0;
+        otaCrc = 0;
+        otaStartTime = millis();
+        isBleOtaInProgress = true;
+        otaWindowed = true;
+        otaShownProgress = -1;
+    } else {
+        Serial.printf("DEBUG: Resuming BLE OTA at offset %u.\n", otaBytesReceived);
+    }
+    // 每次 BEGIN 都重新起算 seq，chunk 大小可隨新連線的 MTU 改變
+    otaBaseOffset = otaBytesReceived;
+    otaChunkSize = chunk;
+    otaWindow = window;
+    otaNextSeq = 0;
+    otaGapReported = false;
+    memset(otaWindowLength, 0, sizeof(otaWindowLength));
+    otaLastActivity = millis();
+    showOtaProgress();
+    sendOtaReady();
+}
+
+static void handleOtaChunk(uint8_t* data, size_t length) {
+    if (!isBleOtaInProgress || !otaWindowed) {
+        sendOtaResult(OTA_RESULT_NO_SESSION);
+        return;
+    }
+    if (length < 8) {
+        sendErrorReport(0x05);
+        return;
+    }
+    otaLastActivity = millis();
+    uint16_t seq;
+    uint32_t offset;
+    memcpy(&seq, &data[1], 2);
+    memcpy(&offset, &data[3], 4);
+    uint8_t* payload = &data[7];
+    size_t payloadLength = length - 7;
+    uint32_t remaining = offset < otaTotalSize ? otaTotalSize - offset : 0;
+    uint32_t expectedLength = min((uint32_t)otaChunkSize, remaining);
+    // 位置由 offset 決定：otaBytesReceived 之後第 ahead 個 chunk
+    uint32_t ahead = offset >= otaBytesReceived ? (offset - otaBytesReceived) / otaChunkSize : 0;
+    if (offset < otaBytesReceived || ahead >= otaWindow) {
+        // 已寫入的重送或超出視窗：回報目前進度讓 App 重新對齊
+        sendOtaAck();
+        return;
+    }
+    if ((offset - otaBytesReceived) % otaChunkSize || seq != (uint16_t)(otaNextSeq + ahead) ||
+        payloadLength != expectedLength || payloadLength == 0) {
+        Serial.printf("ERROR: OTA chunk %u has bad offset/length (%lu, %u).\n", seq, (unsigned long)offset, payloadLength);
+        sendOtaAck();
+        return;
+    }
+    if (ahead > 0) {
+        int slot = ((offset - otaBaseOffset) / otaChunkSize) % otaWindow;
+        memcpy(otaWindowBuffer[slot], payload, payloadLength);
+        otaWindowLength[slot] = payloadLength;
+        otaWindowOffset[slot] = offset;
+        if (!otaGapReported) {
+            otaGapReported = true;
+            sendOtaAck(); // 選擇性確認：App 只需補送缺少的 chunk
+        }
+        return;
+    }
+    bool ok = writeOtaData(payload, payloadLength);
+    // 補齊缺口後，接著寫入視窗中已經到達的後續 chunk
+    while (ok) {
+        int slot = ((otaBytesReceived - otaBaseOffset) / otaChunkSize) % otaWindow;
+        if (otaWindowLength[slot] == 0 || otaWindowOffset[slot] != otaBytesReceived) break;
+        uint16_t n = otaWindowLength[slot];
+        otaWindowLength[slot] = 0;
+        ok = writeOtaData(otaWindowBuffer[slot], n);
+        otaGapReported = false;
+    }
+    if (!ok) {
+        Update.abort();
+        endOtaSession();
+        sendOtaResult(OTA_RESULT_FLASH_ERROR);
+        return;
+    }
+    if (otaChunksSinceAck >= max(1, otaWindow / 2) || otaBytesReceived >= otaTotalSize) sendOtaAck();
+    showOtaProgress();
+}
+
+static void handleOtaFinish() {
+    if (!isBleOtaInProgress || !otaWindowed) {
+        sendOtaResult(OTA_RESULT_NO_SESSION);
+        return;
+    }
+    otaLastActivity = millis();
+    if (otaBytesReceived != otaTotalSize) {
+        Serial.printf("ERROR: OTA finish with %u/%u bytes.\n", otaBytesReceived, otaTotalSize);
+        sendOtaResult(OTA_RESULT_INCOMPLETE);
+        sendOtaAck();
+        return;
+    }
+    if (otaCrc != otaExpectedCrc) {
+        Serial.printf("ERROR: OTA CRC32 mismatch (got %08lX, expected %08lX).\n", (unsigned long)otaCrc, (unsigned long)otaExpectedCrc);
+        Update.abort();
+        endOtaSession();
+        sendOtaResult(OTA_RESULT_CRC_MISMATCH);
+        drawOtaScreen("CRC mismatch!");
+        updateScreens();
+        return;
+    }
+    if (!Update.end(true)) {
+        Serial.println("ERROR: OTA Update failed!");
+        Update.printError(Serial);
+        endOtaSession();
+        sendOtaResult(OTA_RESULT_FLASH_ERROR);
+        updateScreens();
+        return;
+    }
+    Serial.printf("SUCCESS: BLE OTA verified (CRC32 %08lX) in %lu ms. Rebooting...\n", (unsigned long)otaCrc, millis() - otaStartTime);
+    sendOtaResult(OTA_RESULT_OK);
+    flushNotifyQueue(1000);
+    drawOtaScreen("Update OK! Rebooting...", 100);
+    delay(2000);
+    ESP.restart();
+}
+
+// ==================== 舊版 BLE OTA (0x50-0x52) ====================
+// 無序號、無確認，斷線即中止；保留給尚未改用視窗式協定的 App。
+
+static void handleLegacyOtaStart(uint8_t* data, size_t length) {
+    if (length < 5) {
+        Serial.println("ERROR: CMD_OTA_START packet too short!");
+        sendErrorReport(0x05); // Length error
+        return;
+    }
+    if (isBleOtaInProgress) Update.abort();
+    // 從封包中解析韌體總大小 (4 bytes, little-endian)
+    otaTotalSize = (data[4] << 24) | (data[3] << 16) | (data[2] << 8) | data[1];
+    otaBytesReceived = 0;
+
+    Serial.printf("DEBUG: CMD_OTA_START received. Total size: %u bytes\n", otaTotalSize);
+
+    // Display OTA message on screen
+    u8g2.clearBuffer();
+    u8g2.setFont(u8g2_font_ncenB10_tr);
+    u8g2.drawStr((128 - u8g2.getStrWidth("BLE OTA"))/2, 20, "BLE OTA");
+    u8g2.setFont(u8g2_font_ncenB08_tr);
+    u8g2.drawStr((128 - u8g2.getStrWidth("Receiving..."))/2, 40, "Receiving...");
+    sendDisplayFrame();
+
+    if (Update.begin(otaTotalSize)) {
+        isBleOtaInProgress = true;
+        otaWindowed = false;
+        otaStartTime = millis();
+        otaLastActivity = millis();
+        Serial.println("DEBUG: OTA Update process started.");
+    } else {
+        Serial.println("ERROR: Not enough space to begin OTA");
+        Update.printError(Serial);
+        endOtaSession();
+        sendErrorReport(0x04); // Access error / insufficient space
+    }
+}
+
+static void handleLegacyOtaData(uint8_t* data, size_t length) {
+    if (!isBleOtaInProgress || otaWindowed) {
+        Serial.println("ERROR: CMD_OTA_DATA received without START.");
+        sendErrorReport(0x03); // Unknown command / wrong sequence
+        return;
+    }
+    otaLastActivity = millis();
+
+    size_t chunkSize = length - 1;
+
+    if (chunkSize > 0) {
+        size_t bytesWritten = Update.write(&data[1], chunkSize);
+        if (bytesWritten == chunkSize) {
+            otaBytesReceived += bytesWritten;
+            // Update progress on screen
+            int progress = (int)((otaBytesReceived * 100) / otaTotalSize);
+            u8g2.drawBox(0, 50, 128, 10);
+            u8g2.setDrawColor(0); // color 0 for the text
+            char progressStr[5];
+            sprintf(progressStr, "%d%%", progress);
+            u8g2.drawStr((128 - u8g2.getStrWidth(progressStr))/2, 60, progressStr);
+            u8g2.setDrawColor(1); // Back to default
+            u8g2.drawBox(2, 52, (124 * progress) / 100, 6);
+            sendDisplayFrame();
+
+        } else {
+            Serial.println("ERROR: OTA data write failed!");
+            Update.printError(Serial);
+            Update.abort();
+            endOtaSession();
+            sendErrorReport(0x04); // Access error
+        }
+    }
+}
+
+static void handleLegacyOtaEnd() {
+    if (!isBleOtaInProgress || otaWindowed) {
+        Serial.println("ERROR: CMD_OTA_END received without START.");
+        sendErrorReport(0x03); // Unknown command / wrong sequence
+        return;
+    }
+
+    Serial.printf("DEBUG: CMD_OTA_END received. Total bytes received: %u\n", otaBytesReceived);
+
+    if (Update.end(true)) {
+        Serial.printf("SUCCESS: OTA Update successful in %lu ms. Rebooting...\n", millis() - otaStartTime);
+        u8g2.clearBuffer();
+        u8g2.setFont(u8g2_font_ncenB08_tr);
+        u8g2.drawStr((128 - u8g2.getStrWidth("Update OK!"))/2, 20, "Update OK!");
+        u8g2.drawStr((128 - u8g2.getStrWidth("Rebooting..."))/2, 40, "Rebooting...");
+        sendDisplayFrame();
+        delay(2000);
+        ESP.restart();
+    } else {
+        Serial.println("ERROR: OTA Update failed!");
+        Update.printError(Serial);
+        endOtaSession();
+        u8g2.clearBuffer();
+        u8g2.setFont(u8g2_font_ncenB08_tr);
+        u8g2.drawStr((128 - u8g2.getStrWidth("Update Failed!"))/2, 38, "Update Failed!");
+        sendDisplayFrame();
+        delay(3000);
+        // Optionally restart or return to main screen
+        // ESP.restart();
+        sendErrorReport(0x04);
+    }
+}
+
+// ==================== 對外介面 ====================
+
+// 同一時間只有一個 OTA session：其他連線在 session 所屬連線仍在線時送來的 OTA 指令回報 Busy
+void handleOtaCommand(uint8_t* data, size_t length) {
+    int client = getBleClient();
+    if (isBleOtaInProgress && otaClient >= 0 && client != otaClient) {
+        Serial.printf("DEBUG: BLE OTA owned by client %d, rejecting 0x%02X from client %d.\n", otaClient, data[0], client);
+        sendErrorReport(0x06);
+        return;
+    }
+    switch (data[0]) {
+        case CMD_OTA_START:  handleLegacyOtaStart(data, length); break;
+        case CMD_OTA_DATA:   handleLegacyOtaData(data, length); break;
+        case CMD_OTA_END:    handleLegacyOtaEnd(); break;
+        case CMD_OTA_BEGIN:  handleOtaBegin(data, length); break;
+        case CMD_OTA_CHUNK:  handleOtaChunk(data, length); break;
+        case CMD_OTA_FINISH: handleOtaFinish(); break;
+        case CMD_OTA_ABORT:
+            Serial.println("DEBUG: CMD_OTA_ABORT received.");
+            if (isBleOtaInProgress) {
+                Update.abort();
+                endOtaSession();
+                updateScreens();
+            }
+            sendTimeSyncAck();
+            break;
+    }
+    otaClient = isBleOtaInProgress ? client : -1;
+}
+
+// 進行中 session 所屬的連線，沒有或已斷線時為 -1 (連線參數組合據此判斷 OTA 是否在使用該連線)
+int getOtaClient() {
+    return isBleOtaInProgress ? otaClient : -1;
+}
+
+// session 所屬的連線斷線時：舊版 OTA 無法續傳，直接中止；視窗式 OTA 保留進度等待重新連線
+void handleOtaDisconnect(int client) {
+    if (!isBleOtaInProgress || client != otaClient) return;
+    otaClient = -1;
+    if (otaWindowed) {
+        Serial.printf("DEBUG: BLE OTA paused at %u/%u bytes, waiting for reconnect.\n", otaBytesReceived, otaTotalSize);
+        otaLastActivity = millis();
+        return;
+    }
+    Update.abort();
+    endOtaSession();
+}
+
+// loop() 中呼叫：一段時間沒有收到資料 (連線中)、沒有重新連線續傳 (斷線中) 或整個 session 超過上限就放棄。
+// 每個 chunk 都會重設閒置計時，總時間上限避免 App 以極慢的速度一直佔住 session
+void handleOtaTimeout() {
+    if (!isBleOtaInProgress) return;
+    unsigned long limit = otaClient >= 0 ? BLE_OTA_IDLE_TIMEOUT_MS : BLE_OTA_RESUME_TIMEOUT_MS;
+    bool idle = millis() - otaLastActivity > limit;
+    if (!idle && millis() - otaStartTime <= BLE_OTA_MAX_SESSION_MS) return;
+    Serial.printf("ERROR: BLE OTA timed out (%s)!\n", idle ? "idle" : "session limit");
+    Update.abort();
+    endOtaSession();
+    updateScreens();
+}
+
+// 所屬連線在線且最近收到資料時為 true，loop() 此時不重畫畫面也不處理按鍵。
+// 暫停或停頓時交還畫面，恢復傳輸後的下一個 chunk 重畫進度
+bool isBleOtaReceiving() {
+    bool receiving = isBleOtaInProgress && otaClient >= 0 && millis() - otaLastActivity < BLE_OTA_RECEIVING_MS;
+    if (!receiving && otaShownProgress >= 0) {
+        otaShownProgress = -1;
+        updateScreens();
+    }
+    return receiving;
+}
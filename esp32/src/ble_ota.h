@@ -0,0 +1,9 @@
+#pragma once
+
+#include <Arduino.h>
+
+void handleOtaCommand(uint8_t* data, size_t length);
+void handleOtaDisconnect(int client);
+void handleOtaTimeout();
+bool isBleOtaReceiving();
+int getOtaClient();
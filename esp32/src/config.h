@@ -6,8 +6,45 @@
 #define FIRMWARE_VERSION "v22.2"
 
 // ==================== 硬體與儲存常數 ====================
-#define MAX_HISTORY 4800
+// /history.dat 格式 v4：每個 256B 區塊 (一個 SPIFFS page) = 16B 標頭 (起始時間、序號、CRC) + 80 筆 3B 壓縮紀錄
+#define HISTORY_FORMAT_VERSION 4
+#define HISTORY_BLOCK_SIZE 256
+#define HISTORY_BLOCK_HEADER_SIZE 16
+#define HISTORY_RECORD_SIZE 3
+#define HISTORY_RECORDS_PER_BLOCK ((HISTORY_BLOCK_SIZE - HISTORY_BLOCK_HEADER_SIZE) / HISTORY_RECORD_SIZE)
+#define HISTORY_BLOCK_COUNT 225               // 225 x 256B = 57,600B，與 v1 檔案大小相同
+#define MAX_HISTORY (HISTORY_BLOCK_COUNT * HISTORY_RECORDS_PER_BLOCK) // 18000 筆 (30 秒一筆約 150 小時)
+#define LEGACY_MAX_HISTORY 4800               // v1: 4800 x 12B DataPoint
 #define HISTORY_WINDOW_SIZE 60
+#define CHART_COLUMNS 108                 // 圖表區寬度 (像素)，縮放圖表每欄一個 min/max
+#define CHART_SCAN_RECORDS_PER_FRAME 2400 // 縮放圖表每次重畫最多掃描的原始紀錄 (約 7 KB)，其餘留到下一次
+#define DISPLAY_TASK_STACK_SIZE 4096       // display task (I2C 傳送)
+#define DISPLAY_TASK_PRIORITY 1            // 與 loop() 相同；傳送時大多在等 I2C，不會搶走 loop() 的時間
+#define DISPLAY_STATS_INTERVAL_MS 60000UL // 顯示傳輸統計 (bytes/s) 的計算與 log 間隔
+#define DISPLAY_BLINK_INTERVAL_MS 500UL   // 狀態圖示閃爍的半週期
+#define DISPLAY_AGE_REFRESH_MS 60000UL    // 圖表捲動到過去時，時間標示 (-1.2h) 的刷新間隔
+#define DISPLAY_IDLE_REFRESH_MS 600000UL  // 沒有任何失效條件時，最長多久重畫一次
+#define HISTORY_COMMIT_COUNT HISTORY_RECORDS_PER_BLOCK // 每批寫入 flash 的筆數 (一整個區塊)
+#define HISTORY_COMMIT_MAX_AGE_MS 600000UL    // 暫存資料最長停留時間，超過即強制寫入
+static_assert(HISTORY_RECORDS_PER_BLOCK % HISTORY_COMMIT_COUNT == 0, "Commit batches must not straddle history blocks");
+#define HISTORY_TIME_TOLERANCE_S 5            // 取樣時間與區塊預期時間的容許誤差，超過即開新區塊
+#define MIN_VALID_EPOCH 1672531200UL          // 2023-01-01，小於此值代表尚未對時
+// 歷史紀錄儲存後端：預設為 SPIFFS 上的 /history.dat，可擇一開啟
+// #define HISTORY_USE_LITTLEFS                 // 資料檔案系統改用 LittleFS (與 SPIFFS 共用分割區，切換後首次開機會格式化)
+// #define HISTORY_USE_PARTITION                // 區塊環改存於原始 data 分割區的循環日誌 (分割表需加入下列 label)
+#define HISTORY_PARTITION_LABEL "history"     // 至少 (HISTORY_BLOCK_COUNT / 15 + 2) 個 4KB sector，建議 128KB
+#define HISTORY_BENCH_PARTITION_LABEL "histbench"
+// #define HISTORY_STORE_BENCHMARK              // 開機時比較後端的寫入/讀取延遲與抹除次數 (見 history_store.cpp)
+// 多解析度彙總 (min/max/mean)：每層一個以時間定址的環形檔，slot = bucket 序號 % 容量
+#define ROLLUP_TIER_COUNT 3
+#define ROLLUP_MINUTE_SLOTS 1440              // 1 分鐘 x 1440 = 1 天
+#define ROLLUP_HOUR_SLOTS 744                 // 1 小時 x 744 = 31 天
+#define ROLLUP_DAY_SLOTS 366                  // 1 天 x 366 = 1 年
+#define ROLLUP_PENDING_MAX 64                 // 已結束、等待與歷史紀錄一起寫入 flash 的 bucket 數
+#define ROLLUP_TRANSFER_MAX_READS 2           // 彙總傳輸每次 loop 最多讀取的批數 (每批 16 個 bucket，各開檔一次)
+#define SETTINGS_COMMIT_DELAY_MS 5000UL       // 設定值最後一次修改後延遲多久才寫入 NVS (合併連續修改)
+#define HEAP_MONITOR_INTERVAL_MS 60000UL      // heap 水位取樣與 log 間隔
+// #define HEAP_ALLOC_COUNTER                   // 計算 setup() 之後 loop 的 heap 配置次數 (需 CONFIG_HEAP_USE_HOOKS，見 heap_monitor.cpp)
 
 // ==================== 腳位定義 ====================
 #define I2C_SDA_PIN 22
@@ -41,33 +78,94 @@ extern const int DAYLIGHT_OFFSET;
 #define COMMAND_CHANNEL_UUID   "beb5483e-36e1-4688-b7f5-ea07361b26a8"
 #define DATA_EVENT_CHANNEL_UUID "c8c7c599-809c-43a5-b825-1038aa349e5d"
 
+// ==================== BLE 連線參數 ====================
+#define BLE_LOCAL_MTU 517                 // 願意接受的最大 ATT MTU，實際值由手機發起 MTU 交換決定
+#define BLE_DEFAULT_MTU 23                // 未交換前的預設 MTU (notify 最多 20 bytes)
+#define BLE_LE_DATA_LENGTH 251            // 連線後要求的 LE Data Length (單一 link-layer 封包)
+// 連線參數組合 (interval 單位 1.25 ms，timeout 單位 10 ms)：大量傳輸/OTA 用短間隔，閒置時用長間隔加 slave latency 省電
+#define BLE_CONN_BULK_MIN_INTERVAL 6      // 7.5 ms
+#define BLE_CONN_BULK_MAX_INTERVAL 12     // 15 ms (iOS 接受的下限)
+#define BLE_CONN_BULK_LATENCY 0
+#define BLE_CONN_BULK_TIMEOUT 400         // 4 s
+#define BLE_CONN_IDLE_MIN_INTERVAL 80     // 100 ms
+#define BLE_CONN_IDLE_MAX_INTERVAL 120    // 150 ms；加上 latency，App 的指令最多約 450 ms 才被收到
+#define BLE_CONN_IDLE_LATENCY 2
+#define BLE_CONN_IDLE_TIMEOUT 500         // 5 s (需大於 max interval x (latency + 1) x 3)
+#define BLE_CONN_IDLE_DELAY_MS 5000UL     // 連線建立或大量傳輸結束後多久切換為閒置參數
+#define HISTORIC_LEGACY_MAX_POINTS 5      // 0x31 未指定批次上限時每個 0x91 的最大筆數 (舊版 App 上限)
+#define HISTORIC_MAX_POINTS_PER_PACKET 64 // 1 + 64 x 8 = 513 bytes，放得進 517 的 MTU
+#define REALTIME_DEFAULT_MIN_MS 0         // 0x32 未附參數時：每個新樣本都送出 (感測器每 2.5 秒讀一次)
+#define REALTIME_DEFAULT_MAX_MS 0         // 0 = 數值不變時不重送
+#define BLE_MAX_CONNECTIONS 3             // 同時連線的 central 數 (不可超過 CONFIG_BT_ACL_CONNECTIONS)
+#define BLE_COMMAND_QUEUE_SLOTS 24        // 待 loop() 處理的寫入與連線事件數
+#define BLE_COMMAND_RESERVED_SLOTS (2 * BLE_MAX_CONNECTIONS) // 保留給連線事件 (連線、斷線、MTU、溢位)；寫入可用的 slot 需大於 OTA 視窗
+#define BLE_COMMAND_MAX_LENGTH (BLE_LOCAL_MTU - 3) // 單次 ATT 寫入的最大內容
+#define BLE_NOTIFY_QUEUE_SLOTS 12         // 每個連線待送出的 notify 數
+#define BLE_NOTIFY_MAX_LENGTH (BLE_LOCAL_MTU - 3) // 單一 notify 的最大內容
+#define BLE_NOTIFY_RESERVED_SLOTS 4       // 大量傳輸不可佔用的 slot，留給 ACK、錯誤與狀態回報
+#define BLE_NOTIFY_BURST 4                // 每次 loop 最多送出的 notify 數 (各連線輪流)
+#define BLE_NOTIFY_RETRY_MS 20            // notify 失敗 (緩衝已滿) 後多久重試
+#define BLE_NOTIFY_MAX_RETRIES 10         // 超過即丟棄該封包
+#define BLE_OTA_MAX_CHUNK 500             // 視窗式 OTA 單一 chunk 上限 (實際值另受 MTU 限制)
+#define BLE_OTA_MIN_CHUNK 16              // chunk 下限；MTU 放不下時拒絕 CMD_OTA_BEGIN
+#define BLE_OTA_MAX_WINDOW 16             // 未確認的 chunk 數上限 (ACK bitmap 為 16 位元)
+#define BLE_OTA_IDLE_TIMEOUT_MS 60000UL   // 連線中超過此時間沒有 OTA 資料即中止
+#define BLE_OTA_RESUME_TIMEOUT_MS 300000UL // 斷線後等待重新連線續傳的時間
+#define BLE_OTA_MAX_SESSION_MS 1800000UL  // 一次 OTA session (含斷線續傳) 的總時間上限
+#define BLE_OTA_RECEIVING_MS 3000UL       // 最近這段時間內收到 OTA 資料才視為接收中 (loop() 暫停畫面與按鍵)
+
+// ==================== 狀態事件欄位 (CMD_SUBSCRIBE_EVENTS / CMD_REPORT_STATE_EVENT 的 mask) ====================
+#define STATE_ALARM_RINGING 0x01
+#define STATE_ALARM_CONFIG  0x02
+#define STATE_WIFI          0x04
+#define STATE_SENSOR        0x08
+#define STATE_ENG_MODE      0x10
+#define STATE_SLOTS         0x20
+#define STATE_ALL           0x3F
+
 // ==================== BLE 指令碼 ====================
 #define CMD_PROTOCOL_VERSION        0x01 // 請求協議版本
 #define CMD_TIME_SYNC               0x11 // 時間同步
 #define CMD_WIFI_CREDENTIALS        0x12 // 設定Wi-Fi帳密
 #define CMD_SET_ENGINEERING_MODE    0x13 // 進入工程模式
 #define CMD_REQUEST_ENG_MODE_STATUS 0x14 // 請求工程模式狀態
+#define CMD_SUBSCRIBE_EVENTS        0x15 // 訂閱狀態變化事件 (欄位 mask 1B，0 = 取消)
 #define CMD_REQUEST_STATUS          0x20 // 請求裝置狀態
 #define CMD_REQUEST_ENV             0x30 // 請求環境數據
 #define CMD_REQUEST_HISTORIC        0x31 // 請求歷史紀錄
-#define CMD_ENABLE_REALTIME         0x32 // 啟用即時數據
+#define CMD_ENABLE_REALTIME         0x32 // 啟用即時數據 [最短間隔 2B + 最長間隔 2B (ms) + 溫度門檻 1B (0.1°C) + 濕度門檻 1B (%)]
 #define CMD_DISABLE_REALTIME        0x33 // 禁用即時數據
+#define CMD_REQUEST_ROLLUP          0x34 // 請求彙總資料 (附帶層級與筆數)
+#define CMD_REQUEST_HISTORIC_COMPACT 0x35 // 請求歷史紀錄 (壓縮區塊)
 #define CMD_SET_ALARM               0x41 // 設定鬧鐘
 #define CMD_GUIDE_PILLBOX           0x42 // 引導藥盒轉動
+#define CMD_BATCH                   0x60 // 批次指令 ([長度 1B + 子指令]*，依序執行，回報合併成 0xA0)
 
 // --- BLE OTA Commands ---
 #define CMD_OTA_START               0x50 // 開始 OTA (附帶 4 字節總大小)
 #define CMD_OTA_DATA                0x51 // OTA 數據傳輸
 #define CMD_OTA_END                 0x52 // 結束 OTA
+#define CMD_OTA_BEGIN               0x53 // 視窗式 OTA 開始/續傳 (總大小 4B + CRC32 4B [+ chunk 大小 2B + 視窗 1B])
+#define CMD_OTA_CHUNK               0x54 // 視窗式 OTA 數據 (seq 2B + offset 4B + 數據)
+#define CMD_OTA_FINISH              0x55 // 視窗式 OTA 結束，驗證 CRC32 後重新開機
+#define CMD_OTA_ABORT               0x56 // 放棄 OTA
 
 #define CMD_REPORT_PROTO_VER        0x71 // 回報協議版本
 #define CMD_REPORT_STATUS           0x80 // 回報裝置狀態
 #define CMD_REPORT_TAKEN            0x81 // 回報藥物已取
 #define CMD_TIME_SYNC_ACK           0x82 // 時間同步確認
 #define CMD_REPORT_ENG_MODE_STATUS  0x83 // 回報工程模式狀態
+#define CMD_REPORT_OTA_ACK          0x85 // OTA 確認 (下一個 seq 2B + 已寫入 offset 4B + 其後 16 個 seq 的已收 bitmap 2B)
+#define CMD_REPORT_OTA_RESULT       0x86 // OTA 結果 (狀態 1B + 已寫入 offset 4B + CRC32 4B)
+#define CMD_REPORT_STATE_EVENT      0x87 // 狀態變化事件 (序號 2B + 欄位 mask 1B + 有變化的欄位，見 ble_events.cpp)
+#define CMD_REPORT_OTA_READY        0x88 // OTA 就緒 (續傳 offset 4B + 下一個 seq 2B + chunk 大小 2B + 視窗 1B)；0x84 是 App 的 Wi-Fi 狀態
 #define CMD_REPORT_ENV              0x90 // 回報環境數據
 #define CMD_REPORT_HISTORIC_POINT   0x91 // 回報單筆歷史紀錄
 #define CMD_REPORT_HISTORIC_END     0x92 // 歷史紀錄回報結束
+#define CMD_REPORT_ROLLUP           0x93 // 回報單筆彙總資料
+#define CMD_REPORT_ROLLUP_END       0x94 // 彙總資料回報結束
+#define CMD_REPORT_HISTORIC_BLOCK   0x95 // 回報壓縮歷史紀錄區塊 (格式見 history_codec.h)
+#define CMD_REPORT_BATCH            0xA0 // 批次指令的合併回報 (frame 序號 1B，最高位元 = 最後一個 + [長度 1B + 回報]*)
 #define CMD_ERROR                   0xEE // 錯誤回報
 
 // ==================== 圖示 (XBM) ====================
@@ -1,14 +1,21 @@
 
 #include "globals.h"
 #include <time.h>
+#include <sys/time.h>
 #include <WiFi.h> // <--- Added this include
 
 // Pre-declare functions from other modules that are used here
 void loadHistoryWindow(int offset);
+bool loadRollupWindow(RollupTier tier, int offset);
+bool loadHistoryColumns(ChartResolution zoom, int offset);
+int historyZoomSamplesPerColumn(ChartResolution zoom);
+
+static void finishRender(unsigned long startMicros);
 
 void updateDisplay() {
     // This function is called frequently, so debug messages are commented out by default.
     // Serial.println("DEBUG: updateDisplay"); 
+    unsigned long renderStart = micros();
     lastDisplayUpdate = millis(); 
     u8g2.clearBuffer();
     switch (currentUIMode) {
@@ -35,7 +42,255 @@ void updateDisplay() {
             break;
     }
     drawStatusIcons(); 
-    u8g2.sendBuffer();
+    sendDisplayFrame();
+    finishRender(renderStart);
+}
+
+// ==================== 刷新排程 ====================
+// 不再固定每 displayInterval 重畫；每個畫面宣告會讓它失效的條件，loop() 只在失效時重畫：
+//   - 資料版本：displayKey() 把畫面上顯示的值 (依顯示的精度)、模式、頁面與狀態圖示組成一個 key，與上次重畫時比對
+//   - 時間粒度：nextRefreshMs() 算出內容下一次因時間而改變的期限 (時鐘每秒、日期在午夜、檢視過去的圖表每分鐘)
+//   - 閃爍相位：drawStatusIcons() 有閃爍中的圖示時，期限對齊下一個 DISPLAY_BLINK_INTERVAL_MS 相位
+//   - 輸入事件：input.cpp 與各模組在改變畫面時直接呼叫 updateDisplay() / updateScreens()
+// 其他模組自行畫的畫面 (OTA、Rebooting...) 送出後，下一次檢查一定重畫回原本的畫面。
+// key 最多每 displayInterval 比對一次；到期限時不受此限制，時鐘準時跳秒。
+static uint32_t renderedKey = 0;
+static unsigned long renderedAt = 0;
+static unsigned long renderDeadlineMs = 0;  // renderedAt 之後多久到期
+static bool screenRendered = false;         // 螢幕上是 updateDisplay() 畫的畫面
+static unsigned long lastDisplayCheck = 0;
+static bool chartScanPending = false;       // 縮放圖表還在分段掃描，下一次檢查繼續
+
+static uint32_t mixKey(uint32_t key, uint32_t value) {
+    return (key ^ value) * 16777619UL; // FNV-1a
+}
+
+static uint32_t mixKey(uint32_t key, const String& value) {
+    for (size_t i = 0; i < value.length(); i++) key = mixKey(key, (uint8_t)value[i]);
+    return key;
+}
+
+static bool syncIconActive() {
+    return millis() - syncIconStartTime < SYNC_ICON_DURATION;
+}
+
+static uint32_t displayKey() {
+    uint32_t key = mixKey(2166136261UL, currentUIMode);
+    key = mixKey(key, isEngineeringMode);
+    if (currentUIMode == UI_MODE_SYSTEM_MENU) {
+        key = mixKey(key, selectedMenuItem);
+        key = mixKey(key, menuViewOffset);
+    }
+    if (currentUIMode != UI_MODE_MAIN_SCREENS) return key;
+    key = mixKey(key, currentPageIndex);
+    key = mixKey(key, currentEncoderMode);
+    switch (currentPageIndex) {
+        case SCREEN_TIME:
+            // 狀態圖示只畫在時間頁；閃爍相位由期限處理
+            key = mixKey(key, bleDeviceConnected);
+            key = mixKey(key, wifiState);
+            key = mixKey(key, syncIconActive());
+            // fall through
+        case SCREEN_DATE:
+            key = mixKey(key, time(nullptr) >= MIN_VALID_EPOCH);
+            break;
+        case SCREEN_WEATHER:
+            key = mixKey(key, city);
+            key = mixKey(key, wifiState == WIFI_CONNECTED);
+            key = mixKey(key, weatherData.valid);
+            key = mixKey(key, (uint32_t)lroundf(weatherData.temp * 10));
+            key = mixKey(key, weatherData.humidity);
+            key = mixKey(key, weatherData.description);
+            break;
+        case SCREEN_SENSOR:
+            key = mixKey(key, sensorDataValid);
+            key = mixKey(key, (uint32_t)lroundf(cachedTemp * 10));
+            key = mixKey(key, (uint32_t)lroundf(cachedHum));
+            break;
+        case SCREEN_TEMP_CHART:
+        case SCREEN_HUM_CHART:
+        case SCREEN_RSSI_CHART:
+            // 新的一筆紀錄 (historyIndex) 也會更新彙總 bucket
+            key = mixKey(key, historyCount);
+            key = mixKey(key, historyIndex);
+            key = mixKey(key, historyViewOffset);
+            key = mixKey(key, chartResolution);
+            break;
+        default:
+            break;
+    }
+    return key;
+}
+
+// 目前畫面的內容多久後會因時間而改變
+static unsigned long nextRefreshMs() {
+    unsigned long ms = DISPLAY_IDLE_REFRESH_MS;
+    if (currentUIMode == UI_MODE_INFO_SCREEN) return 1000; // heap 與 uptime
+    if (currentUIMode != UI_MODE_MAIN_SCREENS) return ms;
+    time_t now = time(nullptr);
+    switch (currentPageIndex) {
+        case SCREEN_TIME:
+            if (now >= MIN_VALID_EPOCH) {
+                struct timeval tv;
+                gettimeofday(&tv, nullptr);
+                ms = 1000 - tv.tv_usec / 1000;
+            }
+            if (wifiState == WIFI_CONNECTING || syncIconActive()) {
+                ms = min(ms, DISPLAY_BLINK_INTERVAL_MS - millis() % DISPLAY_BLINK_INTERVAL_MS);
+            }
+            if (syncIconActive()) ms = min(ms, SYNC_ICON_DURATION - (millis() - syncIconStartTime));
+            break;
+        case SCREEN_DATE:
+            if (now >= MIN_VALID_EPOCH) {
+                struct tm* ptm = localtime(&now);
+                unsigned long toMidnight = (23 - ptm->tm_hour) * 3600UL + (59 - ptm->tm_min) * 60UL + (60 - ptm->tm_sec);
+                ms = min(ms, toMidnight * 1000);
+            }
+            break;
+        case SCREEN_TEMP_CHART:
+        case SCREEN_HUM_CHART:
+        case SCREEN_RSSI_CHART:
+            if (chartScanPending) ms = displayInterval;
+            else if (historyViewOffset != 0) ms = DISPLAY_AGE_REFRESH_MS;
+            break;
+        default:
+            break;
+    }
+    return max(ms, 1UL);
+}
+
+static void finishRender(unsigned long startMicros) {
+    renderedKey = displayKey();
+    renderedAt = millis();
+    renderDeadlineMs = nextRefreshMs();
+    screenRendered = true;
+    lastDisplayCheck = renderedAt;
+    displayStats.renders++;
+    displayStats.renderMicros += micros() - startMicros;
+}
+
+// loop() 中呼叫
+void handleDisplayRefresh() {
+    bool due = !screenRendered || millis() - renderedAt >= renderDeadlineMs;
+    if (!due) {
+        if (millis() - lastDisplayCheck < displayInterval) return;
+        lastDisplayCheck = millis();
+        if (displayKey() == renderedKey) return;
+    }
+    updateDisplay();
+}
+
+// ==================== 顯示 task ====================
+// I2C 傳輸 (一個完整畫面要數毫秒) 由獨立的 display task 負責，它是唯一使用 I2C 的地方，loop() 不會因為送畫面而停住。
+// 所有模組照常在 u8g2 的 buffer 中畫好畫面後呼叫 sendDisplayFrame()，不直接 u8g2.sendBuffer()：
+//   - sendDisplayFrame() 只把畫面複製到 pendingFrame 並通知 task，立即返回
+//   - task 把 pendingFrame 與 sendingFrame 交換後送出 sendingFrame，main task 同時可以畫下一個畫面
+//   - task 還在送上一個畫面時又有新畫面，直接覆蓋 pendingFrame (螢幕只需要最新的畫面)
+// 傳送以 u8x8_DrawTile() 直接送 sendingFrame 的內容，不碰 u8g2 的 buffer。
+static const int FRAME_TILES_X = 128 / 8;
+static const int FRAME_TILES_Y = 64 / 8;
+static const int FRAME_ROW_BYTES = FRAME_TILES_X * 8;
+static uint8_t frameBuffers[2][FRAME_ROW_BYTES * FRAME_TILES_Y];
+static uint8_t* pendingFrame = frameBuffers[0];  // 最新完成、尚未送出的畫面
+static uint8_t* sendingFrame = frameBuffers[1];  // task 正在送出的畫面
+static bool framePending = false;
+static portMUX_TYPE frameMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t displayTaskHandle = nullptr;
+
+// ---- 部分更新 (display task) ----
+// 保留上次送到 SH1106 的畫面，逐個 8x8 tile (一個 page 中的 8 個 column bytes) 比對，
+// 只送出有變化的 tile；整個畫面沒有變化時完全不佔用 I2C。
+// 同一列中相鄰或只隔一個未變化 tile 的區段合併成一次傳輸，減少設定位址的指令。
+static uint8_t sentFrame[FRAME_ROW_BYTES * FRAME_TILES_Y];
+static bool sentFrameValid = false;   // 開機後第一個畫面整個送出
+static unsigned long displayStatsStart = 0;
+static uint32_t displayStatsBytes = 0; // 統計區間開始時的 bytesSent
+
+static void updateDisplayStats() {
+    unsigned long elapsed = millis() - displayStatsStart;
+    if (elapsed < DISPLAY_STATS_INTERVAL_MS) return;
+    displayStats.bytesPerSecond = (uint64_t)(displayStats.bytesSent - displayStatsBytes) * 1000 / elapsed;
+    Serial.printf("DEBUG: Display - %lu renders (%lu us total), %lu frames (%lu unchanged, %lu replaced before sending), %lu tiles, %lu bytes in %lu us, %lu bytes/s\n",
+                  (unsigned long)displayStats.renders, (unsigned long)displayStats.renderMicros,
+                  (unsigned long)displayStats.frames, (unsigned long)displayStats.framesUnchanged, (unsigned long)displayStats.framesReplaced,
+                  (unsigned long)displayStats.tilesSent, (unsigned long)displayStats.bytesSent, (unsigned long)displayStats.sendMicros,
+                  (unsigned long)displayStats.bytesPerSecond);
+    displayStatsStart = millis();
+    displayStatsBytes = displayStats.bytesSent;
+}
+
+static void sendTiles(int tx, int ty, int count, uint8_t* row) {
+    u8x8_DrawTile(u8g2.getU8x8(), tx, ty, count, row + tx * 8);
+    displayStats.tilesSent += count;
+    displayStats.bytesSent += count * 8;
+}
+
+static void transferFrame(uint8_t* frame) {
+    unsigned long start = micros();
+    displayStats.frames++;
+    bool changed = false;
+    for (int ty = 0; ty < FRAME_TILES_Y; ty++) {
+        uint8_t* row = frame + ty * FRAME_ROW_BYTES;
+        uint8_t* sentRow = sentFrame + ty * FRAME_ROW_BYTES;
+        if (!sentFrameValid) {
+            sendTiles(0, ty, FRAME_TILES_X, row);
+            changed = true;
+            continue;
+        }
+        int tx = 0;
+        while (tx < FRAME_TILES_X) {
+            if (memcmp(row + tx * 8, sentRow + tx * 8, 8) == 0) { tx++; continue; }
+            int start = tx, end = tx + 1; // [start, end) 為要送出的區段
+            for (tx = end; tx < FRAME_TILES_X; tx++) {
+                if (memcmp(row + tx * 8, sentRow + tx * 8, 8) != 0) end = tx + 1;
+                else if (tx - end >= 1) break; // 連續兩個未變化的 tile 才切開
+            }
+            sendTiles(start, ty, end - start, row);
+            changed = true;
+            tx = end;
+        }
+    }
+    if (changed) u8x8_RefreshDisplay(u8g2.getU8x8());
+    else displayStats.framesUnchanged++;
+    memcpy(sentFrame, frame, sizeof(sentFrame));
+    sentFrameValid = true;
+    displayStats.sendMicros += micros() - start;
+    updateDisplayStats();
+}
+
+static void displayTask(void* param) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        portENTER_CRITICAL(&frameMux);
+        bool ready = framePending;
+        if (ready) {
+            uint8_t* frame = pendingFrame;
+            pendingFrame = sendingFrame;
+            sendingFrame = frame;
+            framePending = false;
+        }
+        portEXIT_CRITICAL(&frameMux);
+        if (ready) transferFrame(sendingFrame);
+    }
+}
+
+// u8g2.begin() 之後、第一次 sendDisplayFrame() 之前呼叫
+void setupDisplay() {
+    if (xTaskCreate(displayTask, "display", DISPLAY_TASK_STACK_SIZE, nullptr, DISPLAY_TASK_PRIORITY, &displayTaskHandle) != pdPASS) {
+        displayTaskHandle = nullptr;
+        Serial.println("ERROR: Failed to create display task, frames will be sent from loop().");
+    }
+}
+
+void sendDisplayFrame() {
+    screenRendered = false; // updateDisplay() 送出後才會再設回
+    portENTER_CRITICAL(&frameMux);
+    if (framePending) displayStats.framesReplaced++;
+    memcpy(pendingFrame, u8g2.getBufferPtr(), FRAME_ROW_BYTES * FRAME_TILES_Y);
+    framePending = !!displayTaskHandle;
+    portEXIT_CRITICAL(&frameMux);
+    if (displayTaskHandle) xTaskNotifyGive(displayTaskHandle);
+    else transferFrame(pendingFrame);
 }
 
 void drawSystemMenu() {
@@ -65,18 +320,18 @@ void drawSystemMenu() {
     }
 }
 
-void drawOtaScreen(String text, int progress) {
-    Serial.printf("DEBUG: drawOtaScreen - Text: %s, Progress: %d\n", text.c_str(), progress);
+void drawOtaScreen(const char* text, int progress) {
+    Serial.printf("DEBUG: drawOtaScreen - Text: %s, Progress: %d\n", text, progress);
     u8g2.clearBuffer(); 
     u8g2.setFont(u8g2_font_ncenB08_tr); 
     u8g2.drawStr((128 - u8g2.getStrWidth("OTA Update")) / 2, 12, "OTA Update");
     u8g2.setFont(u8g2_font_profont11_tf); 
-    u8g2.drawStr((128 - u8g2.getStrWidth(text.c_str())) / 2, 32, text.c_str());
+    u8g2.drawStr((128 - u8g2.getStrWidth(text)) / 2, 32, text);
     if (progress >= 0) { 
         u8g2.drawFrame(14, 45, 100, 10); 
         u8g2.drawBox(14, 45, progress, 10); 
     }
-    u8g2.sendBuffer();
+    sendDisplayFrame();
 }
 
 void drawStatusIcons() {
@@ -84,10 +339,10 @@ void drawStatusIcons() {
     int x = 0; 
     const int spacing = 10;
     if (bleDeviceConnected) { u8g2.drawXBM(x, 2, 8, 8, icon_ble_bits); x += spacing; }
-    if (millis() - syncIconStartTime < SYNC_ICON_DURATION && (millis() / 500) % 2 == 0) { u8g2.drawXBM(x, 2, 8, 8, icon_sync_bits); x += spacing; }
+    if (syncIconActive() && (millis() / DISPLAY_BLINK_INTERVAL_MS) % 2 == 0) { u8g2.drawXBM(x, 2, 8, 8, icon_sync_bits); x += spacing; }
     switch (wifiState) {
         case WIFI_CONNECTED: u8g2.drawXBM(x, 2, 8, 8, icon_wifi_bits); break;
-        case WIFI_CONNECTING: if ((millis() / 500) % 2 == 0) { u8g2.drawXBM(x, 2, 8, 8, icon_wifi_connecting_bits); } break;
+        case WIFI_CONNECTING: if ((millis() / DISPLAY_BLINK_INTERVAL_MS) % 2 == 0) { u8g2.drawXBM(x, 2, 8, 8, icon_wifi_connecting_bits); } break;
         default: u8g2.drawXBM(x, 2, 8, 8, icon_wifi_fail_bits); break;
     }
     x += spacing;
@@ -112,20 +367,138 @@ void updateScreens() {
     updateDisplay();
 }
 
+static void formatViewAge(char* out, float hours) {
+    if (hours < 48) sprintf(out, "-%.1fh", hours);
+    else sprintf(out, "-%.0fd", hours / 24);
+}
+
+static void rollupValues(const RollupBucket& b, bool isTemp, bool isRssi, float& lo, float& hi, float& mean) {
+    if (isRssi) { lo = b.rssiMin; hi = b.rssiMax; mean = b.rssiMean; }
+    else if (isTemp) { lo = b.tempMin / 100.0; hi = b.tempMax / 100.0; mean = b.tempMean / 100.0; }
+    else { lo = b.humMin / 100.0; hi = b.humMax / 100.0; mean = b.humMean / 100.0; }
+}
+
+// 彙總圖：每個 bucket 畫一條 min-max 直線，平均值連成折線
+static void drawRollupChart(bool isTemp, bool isRssi) {
+    static const char* tierLabels[] = {"1m", "1h", "1d"};
+    RollupTier tier = (RollupTier)(chartResolution - CHART_MINUTE);
+    u8g2.setFont(u8g2_font_5x7_tr);
+    u8g2.drawStr(128 - u8g2.getStrWidth(tierLabels[tier]) - 2, 10, tierLabels[tier]);
+    if (!loadRollupWindow(tier, historyViewOffset)) { u8g2.setFont(u8g2_font_6x10_tf); u8g2.drawStr(10, 35, "Time not set"); return; }
+    float minVal = 999, maxVal = -999;
+    for (int i = 0; i < HISTORY_WINDOW_SIZE; i++) {
+        if (rollupWindowBuffer[i].count == 0) continue;
+        float lo, hi, mean;
+        rollupValues(rollupWindowBuffer[i], isTemp, isRssi, lo, hi, mean);
+        minVal = min(minVal, lo);
+        maxVal = max(maxVal, hi);
+    }
+    if (minVal > maxVal) { u8g2.setFont(u8g2_font_6x10_tf); u8g2.drawStr(10, 35, "No Data"); return; }
+    float span = isRssi ? 10 : (isTemp ? 1 : 2);
+    if (maxVal - minVal < span) { float mid = (minVal + maxVal) / 2; minVal = mid - span / 2; maxVal = mid + span / 2; }
+    float range = maxVal - minVal;
+    int chartX = 18, chartY = 15, chartW = 128 - chartX - 2, chartH = 40;
+    char buf[12];
+    sprintf(buf, isRssi ? "%.0f" : (isTemp ? "%.1f" : "%.0f"), maxVal);
+    u8g2.drawStr(0, chartY + 5, buf);
+    sprintf(buf, isRssi ? "%.0f" : (isTemp ? "%.1f" : "%.0f"), minVal);
+    u8g2.drawStr(0, chartY + chartH, buf);
+    u8g2.drawFrame(chartX, chartY, chartW, chartH);
+    int lastX = -1, lastY = -1;
+    for (int i = 0; i < HISTORY_WINDOW_SIZE; i++) {
+        if (rollupWindowBuffer[i].count == 0) { lastX = -1; continue; }
+        float lo, hi, mean;
+        rollupValues(rollupWindowBuffer[i], isTemp, isRssi, lo, hi, mean);
+        int x = chartX + (i * chartW / HISTORY_WINDOW_SIZE);
+        int yLo = chartY + chartH - 1 - ((lo - minVal) / range * (chartH - 2));
+        int yHi = chartY + chartH - 1 - ((hi - minVal) / range * (chartH - 2));
+        int y = chartY + chartH - 1 - ((mean - minVal) / range * (chartH - 2));
+        u8g2.drawVLine(x, yHi, yLo - yHi + 1);
+        if (lastX >= 0) u8g2.drawLine(lastX, lastY, x, y);
+        lastX = x;
+        lastY = y;
+    }
+    char offsetStr[10];
+    if (historyViewOffset == 0) strcpy(offsetStr, "Now");
+    else formatViewAge(offsetStr, historyViewOffset * rollupPeriod(tier) / 3600.0);
+    u8g2.drawStr(128 - u8g2.getStrWidth(offsetStr) - 2, 64, offsetStr);
+    if (currentEncoderMode == MODE_VIEW_ADJUST) { u8g2.drawStr(2, 64, "VIEW"); }
+}
+
+static void columnValues(const ChartColumn& c, bool isTemp, bool isRssi, float& lo, float& hi) {
+    if (isRssi) { lo = c.rssiMin; hi = c.rssiMax; }
+    else if (isTemp) { lo = c.tempMin / 100.0; hi = c.tempMax / 100.0; }
+    else { lo = c.humMin / 100.0; hi = c.humMax / 100.0; }
+}
+
+// 縮放圖表：每個像素欄畫出該欄樣本的 min-max 直線，並延伸到與前一欄相接，尖峰與斷點都保留
+static void drawZoomChart(bool isTemp, bool isRssi) {
+    static const char* zoomLabels[] = {"2h", "6h", "24h", "All"};
+    u8g2.setFont(u8g2_font_5x7_tr);
+    const char* label = zoomLabels[chartResolution - CHART_ZOOM_2H];
+    u8g2.drawStr(128 - u8g2.getStrWidth(label) - 2, 10, label);
+    chartScanPending = !loadHistoryColumns(chartResolution, historyViewOffset);
+    float minVal = 999, maxVal = -999;
+    for (int i = 0; i < CHART_COLUMNS; i++) {
+        if (chartColumnBuffer[i].count == 0) continue;
+        float lo, hi;
+        columnValues(chartColumnBuffer[i], isTemp, isRssi, lo, hi);
+        minVal = min(minVal, lo);
+        maxVal = max(maxVal, hi);
+    }
+    if (minVal > maxVal) { u8g2.setFont(u8g2_font_6x10_tf); u8g2.drawStr(10, 35, chartScanPending ? "Loading..." : "No Data"); return; }
+    float span = isRssi ? 10 : (isTemp ? 1 : 2);
+    if (maxVal - minVal < span) { float mid = (minVal + maxVal) / 2; minVal = mid - span / 2; maxVal = mid + span / 2; }
+    float range = maxVal - minVal;
+    int chartX = 18, chartY = 15, chartW = CHART_COLUMNS, chartH = 40;
+    char buf[12];
+    sprintf(buf, isRssi ? "%.0f" : (isTemp ? "%.1f" : "%.0f"), maxVal);
+    u8g2.drawStr(0, chartY + 5, buf);
+    sprintf(buf, isRssi ? "%.0f" : (isTemp ? "%.1f" : "%.0f"), minVal);
+    u8g2.drawStr(0, chartY + chartH, buf);
+    u8g2.drawFrame(chartX, chartY, chartW, chartH);
+    int lastTop = -1, lastBottom = -1;
+    for (int i = 0; i < CHART_COLUMNS; i++) {
+        if (chartColumnBuffer[i].count == 0) { lastTop = -1; continue; }
+        float lo, hi;
+        columnValues(chartColumnBuffer[i], isTemp, isRssi, lo, hi);
+        int yHi = chartY + chartH - 1 - ((hi - minVal) / range * (chartH - 2));
+        int yLo = chartY + chartH - 1 - ((lo - minVal) / range * (chartH - 2));
+        // 與前一欄不重疊時延伸過去，避免階梯狀變化看起來像斷開的點
+        int top = lastTop >= 0 ? min(yHi, lastBottom) : yHi;
+        int bottom = lastTop >= 0 ? max(yLo, lastTop) : yLo;
+        u8g2.drawVLine(chartX + i, top, bottom - top + 1);
+        lastTop = yHi;
+        lastBottom = yLo;
+    }
+    char offsetStr[10];
+    if (historyViewOffset == 0) strcpy(offsetStr, "Now");
+    else formatViewAge(offsetStr, (float)historyViewOffset * historyZoomSamplesPerColumn(chartResolution) * historyRecordInterval / 3600000.0);
+    u8g2.drawStr(128 - u8g2.getStrWidth(offsetStr) - 2, 64, offsetStr);
+    if (currentEncoderMode == MODE_VIEW_ADJUST) { u8g2.drawStr(2, 64, "VIEW"); }
+}
+
 void drawChart_OriginalStyle(const char* title, bool isTemp, bool isRssi) {
     // Serial.printf("DEBUG: drawChart_OriginalStyle - Title: %s\n", title);
     u8g2.setFont(u8g2_font_6x10_tf); 
     u8g2.drawStr(2, 8, title);
+    chartScanPending = false;
+    if (chartResolution >= CHART_MINUTE) { drawRollupChart(isTemp, isRssi); return; }
+    if (chartResolution != CHART_RAW) { drawZoomChart(isTemp, isRssi); return; }
     if (historyCount < 2) { u8g2.setFont(u8g2_font_6x10_tf); u8g2.drawStr(10, 35, "No Data"); return; }
     loadHistoryWindow(historyViewOffset);
     int displayCount = min(HISTORY_WINDOW_SIZE, historyCount);
     if (displayCount < 2) { u8g2.drawStr(10, 35, "Insufficient Data"); return; }
     float minVal = 999, maxVal = -999;
+    uint32_t lastTime = 0;
     for (int i = 0; i < displayCount; i++) {
+        if (isnan(historyWindowBuffer[i].temp)) continue; // 空位 (斷電、重開機)
         float val = isRssi ? historyWindowBuffer[i].rssi : (isTemp ? historyWindowBuffer[i].temp : historyWindowBuffer[i].hum);
         if (val < minVal) minVal = val; 
         if (val > maxVal) maxVal = val;
+        if (historyWindowBuffer[i].time) lastTime = historyWindowBuffer[i].time;
     }
+    if (minVal > maxVal) { u8g2.drawStr(10, 35, "No Data"); return; }
     if (isRssi) {
         minVal = max(minVal, -100.0f); 
         maxVal = min(maxVal, -30.0f);
@@ -154,6 +527,7 @@ void drawChart_OriginalStyle(const char* title, bool isTemp, bool isRssi) {
     u8g2.drawFrame(chartX, chartY, chartW, chartH);
     int lastX = -1, lastY = -1;
     for (int i = 0; i < displayCount; i++) {
+        if (isnan(historyWindowBuffer[i].temp)) { lastX = -1; continue; } // 空位處斷線
         float val = isRssi ? historyWindowBuffer[i].rssi : (isTemp ? historyWindowBuffer[i].temp : historyWindowBuffer[i].hum);
         int x = chartX + (i * chartW / displayCount); 
         int y = chartY + chartH - 1 - ((val - minVal) / range * (chartH - 2));
@@ -168,8 +542,12 @@ void drawChart_OriginalStyle(const char* title, bool isTemp, bool isRssi) {
     if (historyViewOffset == 0) { 
         strcpy(offsetStr, "Now"); 
     } else { 
-        float hours = (historyViewOffset * historyRecordInterval) / 3600000.0; 
-        sprintf(offsetStr, "-%.1fh", hours); 
+        // 有時間戳記時以實際時間計算，中間有空位也不會失準
+        time_t now = time(nullptr);
+        float hours = (lastTime && now >= MIN_VALID_EPOCH && (uint32_t)now >= lastTime)
+                      ? (now - lastTime) / 3600.0
+                      : (historyViewOffset * historyRecordInterval) / 3600000.0; 
+        formatViewAge(offsetStr, hours); 
     }
     u8g2.drawStr(128 - u8g2.getStrWidth(offsetStr) - 2, 64, offsetStr);
     if (currentEncoderMode == MODE_VIEW_ADJUST) { u8g2.drawStr(2, 64, "VIEW"); }
@@ -182,7 +560,7 @@ void drawRssiChartScreen() { drawChart_OriginalStyle("RSSI Chart", false, true);
 void drawTimeScreen() {
     time_t now; 
     time(&now);
-    if (now < 1672531200) { 
+    if (now < MIN_VALID_EPOCH) { 
         u8g2.setFont(u8g2_font_ncenB08_tr); 
         u8g2.drawStr(10, 32, "Time not set"); 
     } else { 
@@ -197,7 +575,7 @@ void drawTimeScreen() {
 void drawDateScreen() {
     time_t now; 
     time(&now);
-    if (now < 1672531200) { 
+    if (now < MIN_VALID_EPOCH) { 
         u8g2.setFont(u8g2_font_ncenB08_tr); 
         u8g2.drawStr(10, 32, "Time not set"); 
         return; 
@@ -228,7 +606,7 @@ void drawWeatherScreen() {
     }
     if (weatherData.valid) {
         char buf[20]; 
-        const char* icon = getWeatherIcon(weatherData.description);
+        const char* icon = getWeatherIcon(weatherData.description.c_str());
         u8g2.setFont(u8g2_font_open_iconic_weather_4x_t); 
         u8g2.drawStr(5, 50, icon);
         u8g2.setFont(u8g2_font_fub25_tn); 
@@ -267,34 +645,50 @@ void drawSensorScreen() {
     u8g2.drawStr(128 - u8g2.getStrWidth(buf) - 10, 62, buf);
 }
 
+// 每秒重畫，全部格式化到堆疊上的緩衝區，不使用 String (長時間運作時避免 heap 碎片化)
 void drawSystemScreen() {
-    Serial.println("DEBUG: drawSystemScreen");
     u8g2.setFont(u8g2_font_ncenB08_tr);
     u8g2.drawStr(0, 12, "System Info");
     u8g2.drawStr(128 - u8g2.getStrWidth(FIRMWARE_VERSION), 12, FIRMWARE_VERSION);
-    u8g2.setFont(u8g2_font_profont11_tf);
-    int y = 28;
-    String ssid = WiFi.SSID();
-    if (ssid == "") ssid = "N/A";
+    u8g2.setFont(u8g2_font_5x7_tr);
+    char buf[32];
+    int y = 22;
     if (wifiState == WIFI_CONNECTED) {
-        u8g2.drawStr(0, y, ("SSID: " + ssid).c_str()); y += 12;
-        u8g2.drawStr(0, y, ("RSSI: " + String(WiFi.RSSI()) + " dBm").c_str()); y += 12;
-        u8g2.drawStr(0, y, ("IP: " + WiFi.localIP().toString()).c_str()); y += 12;
+        snprintf(buf, sizeof(buf), "SSID %.20s", wifiSSID.length() ? wifiSSID.c_str() : "N/A");
+        u8g2.drawStr(0, y, buf); y += 8;
+        IPAddress ip = WiFi.localIP();
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u %ddBm", ip[0], ip[1], ip[2], ip[3], (int)WiFi.RSSI());
+        u8g2.drawStr(0, y, buf); y += 8;
     } else {
-        u8g2.drawStr(0, y, "WiFi Disconnected"); y += 12;
+        u8g2.drawStr(0, y, "WiFi Disconnected"); y += 16;
+    }
+    snprintf(buf, sizeof(buf), "Heap %luK min %luK", (unsigned long)ESP.getFreeHeap() / 1024, (unsigned long)heapStats.minFreeHeap / 1024);
+    u8g2.drawStr(0, y, buf); y += 8;
+    snprintf(buf, sizeof(buf), "Block %luK min %luK", (unsigned long)ESP.getMaxAllocHeap() / 1024, (unsigned long)heapStats.minLargestBlock / 1024);
+    u8g2.drawStr(0, y, buf); y += 8;
+    snprintf(buf, sizeof(buf), "Up %lu min", millis() / 60000);
+    u8g2.drawStr(0, y, buf); y += 8;
+#if defined(HEAP_ALLOC_COUNTER) && CONFIG_HEAP_USE_HOOKS
+    snprintf(buf, sizeof(buf), "Allocs %lu (+%lu)", (unsigned long)heapStats.loopAllocations, (unsigned long)heapStats.intervalAllocations);
+    u8g2.drawStr(0, y, buf);
+#endif
+}
+
+// 不分大小寫的子字串比對，不複製字串 (中文字不受影響)
+static bool containsIgnoreCase(const char* s, const char* word) {
+    size_t n = strlen(word);
+    for (; *s; s++) {
+        if (strncasecmp(s, word, n) == 0) return true;
     }
-    u8g2.drawStr(0, y, ("Heap: " + String(ESP.getFreeHeap() / 1024) + " KB").c_str()); y += 12;
-    u8g2.drawStr(0, y, ("Up: " + String(millis() / 60000) + " min").c_str());
+    return false;
 }
 
-const char* getWeatherIcon(const String &desc) {
-    String s = desc; 
-    s.toLowerCase();
-    if (s.indexOf("clear") >= 0 || s.indexOf("晴") >= 0) return "A";
-    if (s.indexOf("cloud") >= 0 || s.indexOf("雲") >= 0 || s.indexOf("阴") >= 0) return "C";
-    if (s.indexOf("rain") >= 0 || s.indexOf("雨") >= 0) return "R";
-    if (s.indexOf("snow") >= 0 || s.indexOf("雪") >= 0) return "S";
-    if (s.indexOf("thunder") >= 0 || s.indexOf("雷") >= 0) return "T";
-    if (s.indexOf("fog") >= 0 || s.indexOf("霧") >= 0 || s.indexOf("霾") >= 0) return "M";
+const char* getWeatherIcon(const char* desc) {
+    if (containsIgnoreCase(desc, "clear") || strstr(desc, "晴")) return "A";
+    if (containsIgnoreCase(desc, "cloud") || strstr(desc, "雲") || strstr(desc, "阴")) return "C";
+    if (containsIgnoreCase(desc, "rain") || strstr(desc, "雨")) return "R";
+    if (containsIgnoreCase(desc, "snow") || strstr(desc, "雪")) return "S";
+    if (containsIgnoreCase(desc, "thunder") || strstr(desc, "雷")) return "T";
+    if (containsIgnoreCase(desc, "fog") || strstr(desc, "霧") || strstr(desc, "霾")) return "M";
     return "C";
 }
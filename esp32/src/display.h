@@ -4,6 +4,9 @@
 #include <Arduino.h>
 
 void updateDisplay();
+void handleDisplayRefresh();
+void setupDisplay();
+void sendDisplayFrame();
 void drawStatusIcons();
 void drawChart_OriginalStyle(const char* title, bool isTemp, bool isRssi);
 void drawTimeScreen();
@@ -15,6 +18,6 @@ void drawHumChartScreen();
 void drawRssiChartScreen();
 void drawSystemScreen();
 void drawSystemMenu();
-void drawOtaScreen(String text, int progress = -1);
+void drawOtaScreen(const char* text, int progress = -1);
 void updateScreens();
-const char* getWeatherIcon(const String &desc);
+const char* getWeatherIcon(const char* desc);
@@ -7,6 +7,14 @@
 #include <BLECharacteristic.h>
 #include <Preferences.h>
 #include "SPIFFS.h"
+#ifdef HISTORY_USE_LITTLEFS
+#include <LittleFS.h>
+#define DATA_FS LittleFS          // 歷史紀錄、彙總等資料檔所在的檔案系統
+#define DATA_FS_NAME "littlefs"
+#else
+#define DATA_FS SPIFFS
+#define DATA_FS_NAME "spiffs"
+#endif
 #include <Adafruit_NeoPixel.h>
 
 // ==================== 列舉 (Enums) ====================
@@ -14,6 +22,9 @@ enum WiFiState { WIFI_IDLE, WIFI_CONNECTING, WIFI_CONNECTED, WIFI_FAILED };
 enum ScreenState { SCREEN_TIME, SCREEN_WEATHER, SCREEN_HISTORY_CHART, SCREEN_PILL_STATUS };
 enum UIMode { UI_MODE_MAIN_SCREENS, UI_MODE_SYSTEM_MENU, UI_MODE_HISTORY_VIEW };
 enum EncoderMode { MODE_NAVIGATION, MODE_VALUE_CHANGE, MODE_MENU_SELECTION, MODE_HISTORY_SCROLL };
+enum RollupTier { ROLLUP_MINUTE, ROLLUP_HOUR, ROLLUP_DAY };
+// CHART_ZOOM_*: 整個環形緩衝區的原始紀錄縮放成 CHART_COLUMNS 欄；CHART_MINUTE + tier: 彙總層
+enum ChartResolution { CHART_RAW, CHART_ZOOM_2H, CHART_ZOOM_6H, CHART_ZOOM_24H, CHART_ZOOM_ALL, CHART_MINUTE, CHART_HOUR, CHART_DAY };
 enum SystemMenuItem { MENU_ITEM_WIFI, MENU_ITEM_OTA, MENU_ITEM_INFO, MENU_ITEM_REBOOT };
 
 // ==================== 結構 (Structs) ====================
@@ -28,6 +39,81 @@ struct DataPoint {
     float temp;
     float hum;
     long rssi;
+    uint32_t time; // Unix 時間，0 = 未知
+};
+
+// 彙總 bucket (24 bytes，直接作為 rollup 檔案的紀錄格式)
+// 溫濕度單位 0.01 (與 BLE 封包相同)，RSSI 單位 dBm；count 為 0 代表該時段沒有資料。
+struct RollupBucket {
+    uint32_t start;   // bucket 起始 Unix 時間 (以當地時間對齊)
+    uint16_t count;   // 樣本數
+    int16_t tempMin, tempMax, tempMean;
+    int16_t humMin, humMax, humMean;
+    int16_t rssiMin, rssiMax, rssiMean;
+};
+
+// 縮放圖表的一欄 (一個像素寬)：落在這一欄的所有樣本的範圍，尖峰不會被平均掉
+struct ChartColumn {
+    uint16_t count;   // 有效樣本數，0 = 沒有資料
+    int16_t tempMin, tempMax;  // 與 RollupBucket 相同的單位
+    int16_t humMin, humMax;
+    int16_t rssiMin, rssiMax;
+};
+
+// 歷史紀錄寫入成本統計 (flash 磨損估算)
+struct HistoryWriteStats {
+    uint32_t samples = 0;          // 已加入的樣本數
+    uint32_t commits = 0;          // /history.dat 開檔寫入次數
+    uint32_t bytesWritten = 0;     // 寫入檔案的位元組
+    uint32_t nvsWrites = 0;        // NVS put 次數
+};
+
+// 顯示傳輸統計 (只送出有變化的 tile)
+struct DisplayStats {
+    uint32_t frames = 0;           // 送出的畫面
+    uint32_t framesUnchanged = 0;  // 與上次相同、沒有任何傳輸
+    uint32_t tilesSent = 0;        // 8x8 tile
+    uint32_t bytesSent = 0;        // 畫面資料 bytes (不含 I2C 位址與指令)
+    uint32_t bytesPerSecond = 0;   // 最近一個統計區間的平均
+    uint32_t renders = 0;          // updateDisplay() 重畫次數
+    uint32_t renderMicros = 0;     // 重畫累計耗時 (main task，不含 I2C 傳送)
+    uint32_t framesReplaced = 0;   // 還沒送出就被新畫面取代
+    uint32_t sendMicros = 0;       // display task 傳送累計耗時
+};
+
+// Heap 水位 (heap_monitor.cpp)
+struct HeapStats {
+    uint32_t freeHeap = 0;
+    uint32_t minFreeHeap = 0;           // 開機以來的最低可用 heap
+    uint32_t largestBlock = 0;          // 最大的連續可用區塊
+    uint32_t minLargestBlock = 0;       // 取樣到的最大可用區塊最低值 (碎片化指標)
+    uint32_t loopAllocations = 0;       // setup() 之後 main task 的配置次數 (HEAP_ALLOC_COUNTER)
+    uint32_t intervalAllocations = 0;   // 最近一個取樣區間的配置次數
+};
+
+// BLE 連線參數組合 (ble_link.cpp)
+enum BleLinkProfile : uint8_t {
+    BLE_PROFILE_DEFAULT = 0, // 沿用手機決定的參數 (連線初期)
+    BLE_PROFILE_BULK,        // 歷史/彙總傳輸與 OTA：短間隔、2M PHY
+    BLE_PROFILE_IDLE,        // 閒置：長間隔加 slave latency
+    BLE_PROFILE_COUNT
+};
+
+// BLE 連線統計
+struct BleLinkStats {
+    uint32_t commandsReceived = 0; // 放入指令佇列的寫入
+    uint32_t commandsDropped = 0;  // 佇列已滿或超過長度而丟棄的寫入
+    uint16_t commandQueuePeak = 0; // 佇列最高深度
+    uint32_t notificationsSent = 0;
+    uint32_t notificationsDropped = 0;   // 佇列已滿、重試失敗、App 未訂閱或斷線時仍在佇列中
+    uint32_t notificationsCoalesced = 0; // 被較新的同類回報取代而不需送出
+    uint32_t notificationRetries = 0;
+    uint32_t congestionEvents = 0;
+    uint16_t notifyQueuePeak = 0;
+    uint8_t clientsPeak = 0;             // 同時連線數最高值
+    uint16_t profileSwitches = 0;        // 連線參數組合切換次數
+    uint32_t profileBytes[BLE_PROFILE_COUNT] = {};  // 各參數組合下收發的 bytes (notify + 寫入)
+    uint32_t profileMillis[BLE_PROFILE_COUNT] = {}; // 各參數組合累計的連線時間
 };
 
 // ==================== 全域物件宣告 ====================
@@ -37,10 +123,11 @@ extern DHT dht;
 extern Adafruit_NeoPixel pixels;
 extern BLECharacteristic *pDataEventCharacteristic;
 extern Preferences preferences;
-extern File historyFile;
 
 // ==================== 全域變數宣告 ====================
 extern WiFiState wifiState;
+extern String wifiSSID;
+extern String wifiPassword;
 extern unsigned long wifiConnectionStartTime;
 extern UIMode currentUIMode;
 extern SystemMenuItem selectedMenuItem;
@@ -54,7 +141,14 @@ extern DataPoint historyWindowBuffer[60];
 extern int historyIndex;
 extern int historyCount;
 extern int historyViewOffset;
-extern bool bleDeviceConnected;
+extern RollupBucket rollupWindowBuffer[60];
+extern ChartColumn chartColumnBuffer[108];
+extern ChartResolution chartResolution;
+extern HistoryWriteStats historyWriteStats;
+extern BleLinkStats bleLinkStats;
+extern DisplayStats displayStats;
+extern HeapStats heapStats;
+extern bool bleDeviceConnected; // 至少有一個 BLE 連線
 extern bool isEngineeringMode;
 
 // --- OTA & System State ---
@@ -65,9 +159,6 @@ extern size_t otaTotalSize;
 extern size_t otaBytesReceived;
 
 // --- Data & Sync State ---
-extern bool isSendingHistoricData;
-extern int historicDataIndexToSend;
-extern unsigned long historicDataStartTime;
 extern unsigned long lastDisplayUpdate;
 extern const unsigned long displayInterval;
 extern unsigned long lastHistoryRecord;
@@ -83,9 +174,6 @@ extern const unsigned long NTP_RESYNC_INTERVAL;
 extern unsigned long lastWeatherUpdate;
 extern const unsigned long WEATHER_INTERVAL;
 extern unsigned long lastBackPressTime;
-extern bool isRealtimeEnabled;
-extern unsigned long lastRealtimeSend;
-extern const unsigned long REALTIME_INTERVAL;
 extern float cachedTemp;
 extern float cachedHum;
 extern bool sensorDataValid;
@@ -97,6 +185,7 @@ extern uint8_t alarmHour;
 extern uint8_t alarmMinute;
 extern bool alarmEnabled;
 extern bool isAlarmRinging;
+extern uint8_t slotStatusMask;
 extern unsigned long lastAlarmCheckTime;
 
 // ==================== 函式原型宣告 ====================
@@ -110,18 +199,40 @@ void runPOST();
 void addDataToHistory(float temp, float hum, long rssi);
 void initializeHistoryFile();
 void loadHistoryMetadata();
+void flushHistory();
+void handleHistoryCommit();
+int readHistoryRange(int first, int count, DataPoint* out);
+int findHistoryIndexAfter(uint32_t since);
+void initializeRollupFiles();
+uint32_t rollupPeriod(RollupTier tier);
+int rollupCapacity(RollupTier tier);
+int readRollupRange(RollupTier tier, uint32_t endTime, int count, RollupBucket* out);
+bool loadHistoryColumns(ChartResolution zoom, int offset);
+int historyZoomSamplesPerColumn(ChartResolution zoom);
+int historyViewMaxOffset();
 void loadPersistentStates();
+void setEngineeringMode(bool enabled);
+void setAlarm(uint8_t hour, uint8_t minute, bool enabled);
+void setWiFiCredentials(const String& ssid, const String& pass);
+void flushSettings();
+void handleSettingsCommit();
 void updateSensorReadings();
 void checkAlarm();
 void handleWiFiConnection();
 void handleHistoricDataTransfer();
+void handleRollupTransfer();
 void handleRealtimeData();
+void handleRealtimeSample();
 void handleEncoder();
 void handleEncoderPush();
 void handleButtons();
 void handleBackButton();
 void updateDisplay();
+void handleDisplayRefresh();
+void setupDisplay();
+void sendDisplayFrame();
 void setupBLE();
 void handleCommand(uint8_t* data, size_t length);
+void handleBleCommands();
 void sendTimeSyncAck();
 void sendErrorReport(uint8_t errorCode);
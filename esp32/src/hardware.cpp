@@ -63,7 +63,7 @@ void runPOST() {
     u8g2.clearBuffer();
     u8g2.setFont(u8g2_font_ncenB08_tr);
     u8g2.drawStr((128 - u8g2.getStrWidth("Hardware Check...")) / 2, 38, "Hardware Check...");
-    u8g2.sendBuffer();
+    sendDisplayFrame();
     delay(500);
 
     // Test LED and Buzzer (even if disconnected)
@@ -86,7 +86,7 @@ void runPOST() {
     u8g2.clearBuffer();
     u8g2.setFont(u8g2_font_ncenB08_tr);
     u8g2.drawStr((128 - u8g2.getStrWidth("Motor Test...")) / 2, 38, "Motor Test...");
-    u8g2.sendBuffer();
+    sendDisplayFrame();
 
     runServo(0);
     delay(500); // Wait between movements
@@ -99,7 +99,7 @@ void runPOST() {
     u8g2.clearBuffer();
     u8g2.setFont(u8g2_font_ncenB08_tr);
     u8g2.drawStr((128 - u8g2.getStrWidth("Check OK")) / 2, 38, "Check OK");
-    u8g2.sendBuffer();
+    sendDisplayFrame();
     delay(1000);
     Serial.println("DEBUG: POST finished.");
 }
@@ -126,6 +126,7 @@ void updateSensorReadings() {
             cachedHum = h;
             cachedTemp = t - TEMP_CALIBRATION_OFFSET;
             sensorDataValid = true;
+            handleRealtimeSample(); // 新樣本讀到後立即判斷是否推送給 App
         } else {
             sensorDataValid = false;
             Serial.println("DEBUG: Failed to read from DHT sensor!");
@@ -0,0 +1,70 @@
+#include "globals.h"
+#include "heap_monitor.h"
+#include <esp_heap_caps.h>
+
+// ==================== Heap 監控 ====================
+// 連續運作數週時，重複配置/釋放不同大小的區塊會把 heap 切碎：可用總量還夠，但最大的連續區塊越來越小，
+// 之後需要大區塊的功能 (HTTPS 天氣、OTA) 就會失敗。因此除了最低可用 heap，也追蹤最大可用區塊的最低值。
+// 每 HEAP_MONITOR_INTERVAL_MS 取樣一次，結果放在 heapStats (System Info 畫面顯示)，並寫入 log。
+//
+// 開啟 HEAP_ALLOC_COUNTER 時，以 ESP-IDF 的配置 hook (需要 sdkconfig 的 CONFIG_HEAP_USE_HOOKS) 計算
+// main task (loop) 的配置次數：setup() 結束後的穩定狀態下，重畫、感測、歷史紀錄與即時數據都不應配置記憶體，
+// 每個區間的計數應該維持為 0；不為 0 時依時間對照 log 找出是哪個動作。
+// 已知仍會配置的 (計數中看得到)：
+//   - esp_ble_gatts_send_indicate() 在呼叫的 task 中配置 Bluedroid 的訊息，有連線且送出 notify 時每包一次
+//   - 偶發動作：歷史/彙總寫入 flash 時開檔、天氣更新、NTP 對時，以及超過 64 字元的 Serial.printf
+#if defined(HEAP_ALLOC_COUNTER) && !CONFIG_HEAP_USE_HOOKS
+#warning "HEAP_ALLOC_COUNTER requires CONFIG_HEAP_USE_HOOKS, allocations will not be counted"
+#endif
+
+static TaskHandle_t loopTask = nullptr;
+static unsigned long lastHeapSample = 0;
+
+#if defined(HEAP_ALLOC_COUNTER) && CONFIG_HEAP_USE_HOOKS
+static volatile uint32_t loopAllocations = 0; // 只有 main task 自己會累加
+static uint32_t allocationsAtSample = 0;
+
+// ESP-IDF 在每次配置成功後呼叫 (任何 task，也可能在 flash cache 關閉時)，因此必須放在 IRAM 且不可配置
+extern "C" void IRAM_ATTR esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps) {
+    if (loopTask != nullptr && xTaskGetCurrentTaskHandle() == loopTask) loopAllocations++;
+}
+#endif
+
+static void sampleHeap() {
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    heapStats.freeHeap = ESP.getFreeHeap();
+    heapStats.minFreeHeap = ESP.getMinFreeHeap();
+    heapStats.largestBlock = largest;
+    if (heapStats.minLargestBlock == 0 || largest < heapStats.minLargestBlock) heapStats.minLargestBlock = largest;
+#if defined(HEAP_ALLOC_COUNTER) && CONFIG_HEAP_USE_HOOKS
+    uint32_t total = loopAllocations;
+    heapStats.intervalAllocations = total - allocationsAtSample;
+    heapStats.loopAllocations = total;
+    allocationsAtSample = total;
+#endif
+}
+
+// setup() 結束時呼叫：之後就是穩定狀態
+void setupHeapMonitor() {
+    loopTask = xTaskGetCurrentTaskHandle();
+    sampleHeap();
+    lastHeapSample = millis();
+}
+
+void handleHeapMonitor() {
+    if (millis() - lastHeapSample < HEAP_MONITOR_INTERVAL_MS) return;
+    lastHeapSample = millis();
+    sampleHeap();
+    // Serial.printf 超過 64 字元時會配置暫存區，這裡先格式化到固定的緩衝區
+    static char line[160];
+    int n = snprintf(line, sizeof(line), "DEBUG: Heap - free %lu (min %lu), largest block %lu (min %lu)",
+                     (unsigned long)heapStats.freeHeap, (unsigned long)heapStats.minFreeHeap,
+                     (unsigned long)heapStats.largestBlock, (unsigned long)heapStats.minLargestBlock);
+#if defined(HEAP_ALLOC_COUNTER) && CONFIG_HEAP_USE_HOOKS
+    snprintf(line + n, sizeof(line) - n, ", loop allocations %lu (total %lu)",
+             (unsigned long)heapStats.intervalAllocations, (unsigned long)heapStats.loopAllocations);
+#else
+    (void)n;
+#endif
+    Serial.println(line);
+}
@@ -0,0 +1,65 @@
+#include "history_codec.h"
+#include <string.h>
+
+static size_t putVarint(uint8_t* out, int32_t value) {
+    uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); // zigzag
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    return n;
+}
+
+void historyBlockBegin(HistoryBlockEncoder& enc, uint8_t* buf, size_t capacity, uint8_t opcode, uint8_t seq, uint8_t interval) {
+    enc.buf = buf;
+    enc.capacity = capacity;
+    enc.length = 0;
+    enc.interval = interval;
+    enc.count = 0;
+    enc.run = 0;
+    buf[0] = opcode;
+    buf[1] = seq;
+}
+
+bool historyBlockAdd(HistoryBlockEncoder& enc, uint32_t time, int16_t temp, uint8_t hum) {
+    if (enc.count == 0) {
+        if (enc.capacity < HISTORY_CODEC_HEADER_SIZE) return false;
+        memcpy(&enc.buf[2], &time, 4);
+        enc.buf[6] = enc.interval;
+        memcpy(&enc.buf[7], &temp, 2);
+        enc.buf[9] = hum;
+        enc.length = HISTORY_CODEC_HEADER_SIZE;
+    } else {
+        int32_t timeDelta = (int32_t)(time - enc.lastTime) - enc.interval;
+        int32_t tempDelta = temp - enc.lastTemp;
+        int32_t humDelta = hum - enc.lastHum;
+        if (timeDelta == 0 && tempDelta == 0 && humDelta == 0) {
+            if (enc.run > 0 && enc.run < HISTORY_CODEC_MAX_RUN) {
+                enc.buf[enc.runPos] = enc.run++;
+            } else {
+                if (enc.length + 1 > enc.capacity) return false;
+                enc.runPos = enc.length;
+                enc.buf[enc.length++] = 0;
+                enc.run = 1;
+            }
+        } else {
+            uint8_t token[16];
+            size_t n = 1;
+            token[0] = 0x80;
+            if (timeDelta) { token[0] |= HISTORY_CODEC_FLAG_TIME; n += putVarint(&token[n], timeDelta); }
+            if (tempDelta) { token[0] |= HISTORY_CODEC_FLAG_TEMP; n += putVarint(&token[n], tempDelta); }
+            if (humDelta)  { token[0] |= HISTORY_CODEC_FLAG_HUM;  n += putVarint(&token[n], humDelta); }
+            if (enc.length + n > enc.capacity) return false;
+            memcpy(&enc.buf[enc.length], token, n);
+            enc.length += n;
+            enc.run = 0;
+        }
+    }
+    enc.count++;
+    enc.lastTime = time;
+    enc.lastTemp = temp;
+    enc.lastHum = hum;
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ==================== 壓縮歷史傳輸格式 (0x95) ====================
+// 每個封包是一個獨立可解碼的區塊，遺失一包不影響其他包：
+//   [0]     0x95
+//   [1]     區塊序號 (每包 +1，mod 256，讓 App 偵測遺失)
+//   [2-5]   第一筆的時間 (Unix time, little-endian)
+//   [6]     取樣間隔 (秒)
+//   [7-8]   第一筆溫度 (int16, 0.1°C)
+//   [9]     第一筆濕度 (%)
+//   [10-]   其後各筆，以前一筆為基準的 token，直到封包結束：
+//     0nnnnnnn          n+1 筆與前一筆相同，時間各加一個間隔
+//     10000dth [varint] 一筆：d = 時間差不等於間隔 (後接 時間差-間隔)，
+//                       t = 溫度改變 (後接 溫度差)，h = 濕度改變 (後接 濕度差)
+// varint 為 zigzag 編碼的有號整數，LEB128 (每 byte 7 位元，最高位元 = 還有下一個 byte)。
+// 參考解碼器見 esp32/tools/history_decoder.cpp。
+#define HISTORY_CODEC_HEADER_SIZE 10
+#define HISTORY_CODEC_MAX_RUN 128
+#define HISTORY_CODEC_FLAG_TIME 0x04
+#define HISTORY_CODEC_FLAG_TEMP 0x02
+#define HISTORY_CODEC_FLAG_HUM  0x01
+
+struct HistoryBlockEncoder {
+    uint8_t* buf;
+    size_t capacity;
+    size_t length;
+    uint8_t interval;
+    uint16_t count;      // 區塊內的筆數
+    size_t runPos;       // 目前 run token 的位置
+    uint8_t run;         // 目前 run 的筆數，0 = 沒有進行中的 run
+    uint32_t lastTime;
+    int16_t lastTemp;
+    uint8_t lastHum;
+};
+
+void historyBlockBegin(HistoryBlockEncoder& enc, uint8_t* buf, size_t capacity, uint8_t opcode, uint8_t seq, uint8_t interval);
+// 放不下時回傳 false (區塊內容不變)，呼叫端送出目前區塊後以新區塊重試
+bool historyBlockAdd(HistoryBlockEncoder& enc, uint32_t time, int16_t temp, uint8_t hum);
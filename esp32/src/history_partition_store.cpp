@@ -0,0 +1,170 @@
+#include "config.h"
+#include "history_store.h"
+#include <stddef.h>
+
+// 不依賴 globals.h，可與 tools/history_store_bench.cpp 一起在主機上編譯 (esp_partition_* 由模擬的 flash 提供)
+
+static const uint32_t HISTORY_LOG_MAGIC = 0x474F4C48; // "HLOG"
+static const uint16_t HISTORY_LOG_NO_PAGE = 0xFFFF;
+
+// ==================== PartitionHistoryStore ====================
+
+bool PartitionHistoryStore::readSummary(int sector, SectorSummary& summary) {
+    if (esp_partition_read(part, sector * SECTOR_SIZE, &summary, sizeof(summary)) != ESP_OK) return false;
+    return summary.magic == HISTORY_LOG_MAGIC && summary.seq != 0xFFFFFFFF;
+}
+
+bool PartitionHistoryStore::begin() {
+    storeStats.flashMeasured = true;
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!part) {
+        Serial.printf("DEBUG: History partition '%s' not found.\n", label);
+        return false;
+    }
+    sectors = part->size / SECTOR_SIZE;
+    // 全部有效區塊 + head + head 之後的空 sector 都要放得下，回收才一定有進展
+    if (sectors * SLOTS_PER_SECTOR < HISTORY_BLOCK_COUNT + 2 * SLOTS_PER_SECTOR) {
+        Serial.printf("DEBUG: History partition '%s' too small (%d sectors).\n", label, sectors);
+        part = nullptr;
+        return false;
+    }
+    for (int i = 0; i < HISTORY_BLOCK_COUNT; i++) pageOf[i] = HISTORY_LOG_NO_PAGE;
+
+    SectorSummary summary;
+    head = -1;
+    for (int s = 0; s < sectors; s++) {
+        if (readSummary(s, summary) && (head < 0 || summary.seq > headSeq)) {
+            head = s;
+            headSeq = summary.seq;
+        }
+    }
+    if (head < 0) {
+        Serial.printf("DEBUG: Formatting history partition '%s' (%d sectors).\n", label, sectors);
+        headSeq = 0;
+        return enterSector(0);
+    }
+    // sector 依環形順序使用，從 head 的下一個開始走一圈就是由舊到新，後寫入的頁覆蓋先前的對應
+    headSlot = 1;
+    for (int k = 1; k <= sectors; k++) {
+        int s = (head + k) % sectors;
+        if (!readSummary(s, summary)) continue;
+        for (int i = 0; i < SLOTS_PER_SECTOR; i++) {
+            uint16_t b = summary.block[i];
+            if (b >= HISTORY_BLOCK_COUNT) continue;
+            pageOf[b] = s * PAGES_PER_SECTOR + i + 1;
+            if (s == head) headSlot = i + 2;
+        }
+    }
+    // 寫到一半斷電的頁沒有登記在摘要裡，跳過不是空白的頁
+    uint8_t page[HISTORY_BLOCK_SIZE];
+    while (headSlot < PAGES_PER_SECTOR) {
+        esp_partition_read(part, (head * PAGES_PER_SECTOR + headSlot) * HISTORY_BLOCK_SIZE, page, sizeof(page));
+        bool blank = true;
+        for (size_t i = 0; i < sizeof(page) && blank; i++) blank = page[i] == 0xFF;
+        if (blank) break;
+        headSlot++;
+    }
+    Serial.printf("DEBUG: History log on partition '%s': %d sectors, head sector %d slot %d (seq %lu).\n",
+                  label, sectors, head, headSlot, (unsigned long)headSeq);
+    // 完成上次中斷的搬移；放不下的頁在下次換 sector 時由 enterSector 帶過去
+    if (!relocateAfterHead()) Serial.println("DEBUG: History log relocation failed.");
+    return true;
+}
+
+// 抹除 sector 並開始寫入。正常情況下 relocateAfterHead 已把它的有效頁搬走；
+// 斷電留下的半寫頁佔掉 head 的空位時，最後幾頁搬不進 head，先讀進 RAM，抹除後第一個寫回
+// (只有在這段期間再次斷電才會遺失)
+bool PartitionHistoryStore::enterSector(int sector) {
+    int carried = 0;
+    for (int i = 0; i < HISTORY_BLOCK_COUNT; i++) {
+        if (pageOf[i] != HISTORY_LOG_NO_PAGE && pageOf[i] / PAGES_PER_SECTOR == sector) carried++;
+    }
+    uint8_t* carry = carried ? (uint8_t*)malloc(carried * HISTORY_BLOCK_SIZE) : nullptr;
+    uint16_t carriedBlock[SLOTS_PER_SECTOR];
+    carried = 0;
+    for (int i = 0; i < HISTORY_BLOCK_COUNT; i++) {
+        if (pageOf[i] == HISTORY_LOG_NO_PAGE || pageOf[i] / PAGES_PER_SECTOR != sector) continue;
+        if (carry && esp_partition_read(part, pageOf[i] * HISTORY_BLOCK_SIZE, carry + carried * HISTORY_BLOCK_SIZE, HISTORY_BLOCK_SIZE) == ESP_OK) {
+            carriedBlock[carried++] = i;
+        }
+        pageOf[i] = HISTORY_LOG_NO_PAGE;
+    }
+    bool ok = esp_partition_erase_range(part, sector * SECTOR_SIZE, SECTOR_SIZE) == ESP_OK;
+    if (ok) {
+        storeStats.erases++;
+        uint32_t header[2] = {HISTORY_LOG_MAGIC, ++headSeq};
+        ok = esp_partition_write(part, sector * SECTOR_SIZE, header, sizeof(header)) == ESP_OK;
+    }
+    if (ok) {
+        head = sector;
+        headSlot = 1;
+    }
+    for (int i = 0; ok && i < carried; i++) {
+        ok = appendPage(carriedBlock[i], carry + i * HISTORY_BLOCK_SIZE);
+        storeStats.relocations++;
+    }
+    free(carry);
+    return ok;
+}
+
+// 把 head 下一個 sector 仍有效的頁搬到 head，讓它在下次換 sector 時可以直接抹除
+bool PartitionHistoryStore::relocateAfterHead() {
+    int victim = (head + 1) % sectors;
+    SectorSummary summary;
+    if (!readSummary(victim, summary)) return true;
+    uint8_t page[HISTORY_BLOCK_SIZE];
+    for (int i = 0; i < SLOTS_PER_SECTOR; i++) {
+        uint16_t b = summary.block[i];
+        uint16_t p = victim * PAGES_PER_SECTOR + i + 1;
+        if (b >= HISTORY_BLOCK_COUNT || pageOf[b] != p) continue;
+        if (headSlot >= PAGES_PER_SECTOR) return true;  // head 已滿，剩下的頁由下一次 enterSector 帶過去
+        if (esp_partition_read(part, p * HISTORY_BLOCK_SIZE, page, sizeof(page)) != ESP_OK) return false;
+        if (!appendPage(b, page)) return false;
+        storeStats.relocations++;
+    }
+    return true;
+}
+
+bool PartitionHistoryStore::appendPage(int block, const uint8_t* buf) {
+    uint16_t p = head * PAGES_PER_SECTOR + headSlot;
+    if (esp_partition_write(part, p * HISTORY_BLOCK_SIZE, buf, HISTORY_BLOCK_SIZE) != ESP_OK) return false;
+    // 資料頁寫完才登記到摘要，寫到一半斷電的頁開機時會被忽略
+    uint16_t entry = block;
+    size_t entryOffset = head * SECTOR_SIZE + offsetof(SectorSummary, block) + (headSlot - 1) * sizeof(entry);
+    if (esp_partition_write(part, entryOffset, &entry, sizeof(entry)) != ESP_OK) return false;
+    pageOf[block] = p;
+    headSlot++;
+    storeStats.pagesProgrammed++;
+    return true;
+}
+
+bool PartitionHistoryStore::read(int block, size_t offset, uint8_t* buf, size_t len) {
+    if (!part || block < 0 || block >= HISTORY_BLOCK_COUNT) return false;
+    uint16_t p = pageOf[block];
+    if (p == HISTORY_LOG_NO_PAGE) {
+        memset(buf, 0xFF, len);
+        return true;
+    }
+    unsigned long start = micros();
+    bool ok = esp_partition_read(part, p * HISTORY_BLOCK_SIZE + offset, buf, len) == ESP_OK;
+    storeStats.reads++;
+    storeStats.readMicros += micros() - start;
+    return ok;
+}
+
+bool PartitionHistoryStore::writeBlock(int block, const uint8_t* buf) {
+    if (!part || block < 0 || block >= HISTORY_BLOCK_COUNT) return false;
+    unsigned long start = micros();
+    bool ok = true;
+    // head 已滿：進入下一個 sector (已沒有有效頁)，再回收它後面的 sector。
+    // 被回收的 sector 全部有效時搬移會填滿 head，再往下一個 sector 走；容量檢查保證一圈內一定有空位。
+    for (int tries = 0; ok && headSlot >= PAGES_PER_SECTOR; tries++) {
+        ok = tries < sectors && enterSector((head + 1) % sectors) && relocateAfterHead();
+    }
+    if (ok) ok = appendPage(block, buf);
+    uint32_t elapsed = micros() - start;
+    storeStats.writes++;
+    storeStats.writeMicros += elapsed;
+    storeStats.maxWriteMicros = max(storeStats.maxWriteMicros, elapsed);
+    return ok;
+}
@@ -0,0 +1,40 @@
+#include "history_recovery.h"
+
+HistoryHead recoverHistoryHead(int blockCount, int recordsPerBlock, HistoryBlockProbe probe, void* ctx) {
+    const int N = blockCount;
+    HistoryHead result = {-1, 0, 0, 0, 1};
+    uint16_t count = 0;
+    uint32_t firstSeq = probe(ctx, 0, count);
+    int head = -1;
+    if (firstSeq != 0) {
+        // 第一個 seq 小於區塊 0 的位置就是最新區塊的下一個
+        int lo = 1, hi = N;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            result.reads++;
+            if (probe(ctx, mid, count) < firstSeq) hi = mid;
+            else lo = mid + 1;
+        }
+        head = lo - 1;
+    } else {
+        // 區塊 0 無效：全新的檔案，或環形已繞回而區塊 0 正好寫到一半
+        result.reads++;
+        if (probe(ctx, N - 1, count) != 0) head = N - 1;
+    }
+    if (head < 0) return result;
+    uint16_t headCount = 0;
+    result.head = head;
+    result.headSeq = probe(ctx, head, headCount);
+    // 下一個區塊有效 = 已繞回；若它寫到一半，再往後一個有效也代表已繞回
+    int validBlocks = head + 1;
+    result.reads += 2;
+    if (probe(ctx, (head + 1) % N, count) != 0) {
+        validBlocks = N;
+    } else {
+        result.reads++;
+        if (probe(ctx, (head + 2) % N, count) != 0) validBlocks = N - 1;
+    }
+    result.count = (validBlocks - 1) * recordsPerBlock + headCount;
+    result.index = (head * recordsPerBlock + headCount) % (N * recordsPerBlock);
+    return result;
+}
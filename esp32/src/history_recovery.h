@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// ==================== 歷史區塊環的寫入位置還原 ====================
+// 區塊依序寫入環形的 blockCount 個位置，每個有效區塊帶有遞增的 seq；不另存指標，開機時由區塊本身還原。
+// 區塊 0 之後 seq 遞增直到最新區塊 (head)，之後是上一輪較舊的區塊或從未寫入的位置，
+// 因此以二分搜尋找出第一個 seq 小於區塊 0 的位置，約 log2(blockCount) 次讀取。
+// 斷電只會讓最後一次寫入的區塊無效 (head 本身重寫到一半，或 head + 1 寫到一半)，其餘區塊不受影響。
+// 不依賴 Arduino，可在主機上編譯測試 (見 esp32/tools/history_recovery_test.cpp)。
+
+// 讀取第 block 個區塊：有效時回傳 seq 並把筆數填入 count；從未寫入、舊版格式或寫到一半的區塊回傳 0
+typedef uint32_t (*HistoryBlockProbe)(void* ctx, int block, uint16_t& count);
+
+struct HistoryHead {
+    int head;           // 最新的有效區塊，-1 = 沒有任何有效區塊
+    uint32_t headSeq;
+    int count;          // 紀錄筆數 (最新區塊以外的區塊一律視為寫滿，空位也算一筆)
+    int index;          // 下一筆紀錄的 slot
+    int reads;          // 讀取區塊的次數
+};
+
+HistoryHead recoverHistoryHead(int blockCount, int recordsPerBlock, HistoryBlockProbe probe, void* ctx);
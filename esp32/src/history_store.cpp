@@ -0,0 +1,153 @@
+
+#include "globals.h"
+#include "history_store.h"
+
+bool growFileTo(File& file, size_t offset) {
+    size_t size = file.size();
+    if (size >= offset) return true;
+    uint8_t empty[HISTORY_BLOCK_SIZE];
+    memset(empty, 0xFF, sizeof(empty));
+    file.seek(size);
+    while (size < offset) {
+        size_t n = min(offset - size, sizeof(empty));
+        if (file.write(empty, n) != n) return false;
+        size += n;
+    }
+    return true;
+}
+
+// ==================== FileHistoryStore ====================
+
+bool FileHistoryStore::begin() {
+    if (fs.exists(path)) {
+        Serial.printf("DEBUG: %s already exists (%s).\n", path, fsName);
+        return true;
+    }
+    // 只建立空檔，區塊在第一次寫入時才補齊 (見 growFileTo)；檔尾之後一律視為空
+    Serial.printf("DEBUG: %s not found, creating new file (%s).\n", path, fsName);
+    File created = fs.open(path, FILE_WRITE);
+    if (!created) {
+        Serial.printf("DEBUG: Failed to create %s\n", path);
+        return false;
+    }
+    created.close();
+    return true;
+}
+
+bool FileHistoryStore::open(bool writable) {
+    file = fs.open(path, writable ? "r+" : "r");
+    return (bool)file;
+}
+
+void FileHistoryStore::close() {
+    file.close();
+}
+
+bool FileHistoryStore::read(int block, size_t offset, uint8_t* buf, size_t len) {
+    memset(buf, 0xFF, len);
+    if (!file) return false;
+    unsigned long start = micros();
+    file.seek(block * HISTORY_BLOCK_SIZE + offset);
+    file.read(buf, len);
+    storeStats.reads++;
+    storeStats.readMicros += micros() - start;
+    return true;
+}
+
+bool FileHistoryStore::writeBlock(int block, const uint8_t* buf) {
+    if (!file) return false;
+    unsigned long start = micros();
+    size_t offset = block * HISTORY_BLOCK_SIZE;
+    size_t written = 0;
+    if (growFileTo(file, offset)) {
+        file.seek(offset);
+        written = file.write(buf, HISTORY_BLOCK_SIZE);
+    }
+    uint32_t elapsed = micros() - start;
+    storeStats.writes++;
+    storeStats.writeMicros += elapsed;
+    storeStats.maxWriteMicros = max(storeStats.maxWriteMicros, elapsed);
+    return written == HISTORY_BLOCK_SIZE;
+}
+
+// ==================== 後端選擇 ====================
+
+HistoryStore* openHistoryStore(const char* path) {
+#ifdef HISTORY_USE_PARTITION
+    static PartitionHistoryStore partitionStore(HISTORY_PARTITION_LABEL);
+    if (partitionStore.begin()) return &partitionStore;
+    Serial.printf("DEBUG: Falling back to %s for history.\n", DATA_FS_NAME);
+#endif
+    static FileHistoryStore fileStore(DATA_FS, path, DATA_FS_NAME);
+    fileStore.begin();
+    return &fileStore;
+}
+
+// ==================== 後端效能比較 (開發用) ====================
+// 以 HISTORY_STORE_BENCHMARK 編譯時開機執行：在暫存檔與 HISTORY_BENCH_PARTITION_LABEL 分割區上
+// 模擬兩輪區塊環寫入 (每個區塊約提交 4 次，對應 30 秒取樣與 10 分鐘強制提交)，
+// 再做隨機讀取，輸出寫入/讀取延遲；分割區後端另外輸出實際的 page 寫入、抹除與搬移次數
+// (檔案系統自行抹除，無法從外部計數)。SPIFFS 與 LittleFS 共用資料分割區，需分別編譯比較。
+#ifdef HISTORY_STORE_BENCHMARK
+static void benchmarkHistoryStore(HistoryStore& store) {
+    const int commitsPerBlock = 4;
+    const int passes = 2;
+    const int randomReads = 200;
+    uint8_t page[HISTORY_BLOCK_SIZE];
+    if (!store.open(true)) {
+        Serial.printf("BENCH: %s open failed\n", store.name());
+        return;
+    }
+    for (int k = 0; k < passes * HISTORY_BLOCK_COUNT; k++) {
+        memset(page, 0xFF, sizeof(page));
+        for (int c = 1; c <= commitsPerBlock; c++) {
+            // 標頭 (count / CRC) 每次提交都改變，紀錄只會往後增加
+            int records = c * HISTORY_RECORDS_PER_BLOCK / commitsPerBlock;
+            page[0] = k;
+            page[1] = c;
+            for (int i = HISTORY_BLOCK_HEADER_SIZE; i < HISTORY_BLOCK_HEADER_SIZE + records * HISTORY_RECORD_SIZE; i++) {
+                page[i] = random(256);
+            }
+            if (!store.writeBlock(k % HISTORY_BLOCK_COUNT, page)) {
+                Serial.printf("BENCH: %s write failed at block %d\n", store.name(), k);
+                store.close();
+                return;
+            }
+        }
+        yield();
+    }
+    uint32_t readsBefore = store.stats().reads;
+    uint32_t readMicrosBefore = store.stats().readMicros;
+    for (int i = 0; i < randomReads; i++) {
+        // 與 readHistoryRange 相同：標頭 + 區塊內一段連續紀錄
+        int slot = random(HISTORY_RECORDS_PER_BLOCK);
+        store.read(random(HISTORY_BLOCK_COUNT), 0, page, HISTORY_BLOCK_HEADER_SIZE + (slot + 1) * HISTORY_RECORD_SIZE);
+    }
+    store.close();
+    const HistoryStoreStats& s = store.stats();
+    uint32_t reads = max(1UL, (unsigned long)(s.reads - readsBefore));
+    Serial.printf("BENCH: %-9s append avg %lu us (max %lu us), random read avg %lu us, ", store.name(),
+                  s.writeMicros / max(1UL, (unsigned long)s.writes), s.maxWriteMicros, (s.readMicros - readMicrosBefore) / reads);
+    if (s.flashMeasured) {
+        Serial.printf("%lu pages programmed, %lu erases, %lu relocated pages\n", s.pagesProgrammed, s.erases, s.relocations);
+    } else {
+        Serial.println("pages/erases not measured (file system)");
+    }
+}
+
+void runHistoryStoreBenchmark() {
+    static const char* BENCH_FILE = "/histbench.dat";
+    Serial.println("BENCH: History store benchmark starting...");
+    DATA_FS.remove(BENCH_FILE);
+    {
+        FileHistoryStore fileStore(DATA_FS, BENCH_FILE, DATA_FS_NAME);
+        if (fileStore.begin()) benchmarkHistoryStore(fileStore);
+    }
+    DATA_FS.remove(BENCH_FILE);
+    static PartitionHistoryStore partitionStore(HISTORY_BENCH_PARTITION_LABEL);
+    if (partitionStore.begin()) benchmarkHistoryStore(partitionStore);
+    Serial.println("BENCH: Done.");
+}
+#else
+void runHistoryStoreBenchmark() {}
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include <esp_partition.h>
+
+// ==================== 歷史紀錄儲存後端 ====================
+// storage.cpp 只以「區塊」(HISTORY_BLOCK_SIZE) 存取 /history.dat 的區塊環，實際存放位置由後端決定：
+//   FileHistoryStore      - 資料檔案系統 (SPIFFS 或 LittleFS，見 HISTORY_USE_LITTLEFS) 上的檔案
+//   PartitionHistoryStore - 原始 data 分割區上的循環日誌 (HISTORY_USE_PARTITION)
+// 從未寫入的區塊一律讀回 0xFF。
+
+struct HistoryStoreStats {
+    uint32_t reads = 0;
+    uint32_t writes = 0;           // writeBlock 次數
+    uint32_t readMicros = 0;
+    uint32_t writeMicros = 0;
+    uint32_t maxWriteMicros = 0;
+    // 以下只有直接操作 flash 的後端才能計數；檔案系統自行配置與抹除，看不到實際的 page 與 sector
+    bool flashMeasured = false;
+    uint32_t pagesProgrammed = 0;  // 寫入的 256B flash page 數
+    uint32_t erases = 0;           // 4KB sector 抹除次數
+    uint32_t relocations = 0;      // 循環日誌回收時搬移的有效頁
+};
+
+class HistoryStore {
+public:
+    virtual ~HistoryStore() {}
+    virtual const char* name() const = 0;
+    // 找到或建立儲存區，開機時呼叫一次
+    virtual bool begin() = 0;
+    // 一次存取的開始/結束 (檔案後端對應 open/close)
+    virtual bool open(bool writable) = 0;
+    virtual void close() = 0;
+    // 讀取第 block 個區塊 offset 起的 len bytes，讀不到的部分填 0xFF；I/O 錯誤回傳 false
+    virtual bool read(int block, size_t offset, uint8_t* buf, size_t len) = 0;
+    // 整個區塊 (HISTORY_BLOCK_SIZE bytes) 寫入，完成後才回傳 true
+    virtual bool writeBlock(int block, const uint8_t* buf) = 0;
+    const HistoryStoreStats& stats() const { return storeStats; }
+
+protected:
+    HistoryStoreStats storeStats;
+};
+
+class FileHistoryStore : public HistoryStore {
+public:
+    FileHistoryStore(fs::FS& fs, const char* path, const char* fsName) : fs(fs), path(path), fsName(fsName) {}
+    const char* name() const override { return fsName; }
+    bool begin() override;
+    bool open(bool writable) override;
+    void close() override;
+    bool read(int block, size_t offset, uint8_t* buf, size_t len) override;
+    bool writeBlock(int block, const uint8_t* buf) override;
+
+private:
+    fs::FS& fs;
+    const char* path;
+    const char* fsName;
+    File file;
+};
+
+// 循環日誌：每個 4KB sector 的第 0 頁是摘要 (sector 序號 + 各頁存放的邏輯區塊)，其餘 15 頁存放區塊 (256B 區塊)。
+// 每次 writeBlock 都附加到下一個空頁，同一區塊的新版本讓舊版本失效，不需要就地抹除改寫。
+// head 之後的 sector 保持沒有有效頁：進入新 sector 時先把下一個 sector 的有效頁搬過來，
+// 因此抹除時不會遺失資料，抹除次數平均分散到整個分割區。開機時讀各 sector 摘要重建對應表。
+class PartitionHistoryStore : public HistoryStore {
+public:
+    explicit PartitionHistoryStore(const char* label) : label(label) {}
+    const char* name() const override { return "partition"; }
+    bool begin() override;
+    bool open(bool) override { return part != nullptr; }
+    void close() override {}
+    bool read(int block, size_t offset, uint8_t* buf, size_t len) override;
+    bool writeBlock(int block, const uint8_t* buf) override;
+
+private:
+    static const int SECTOR_SIZE = 4096;
+    static const int PAGES_PER_SECTOR = SECTOR_SIZE / HISTORY_BLOCK_SIZE;
+    static const int SLOTS_PER_SECTOR = PAGES_PER_SECTOR - 1;
+
+    struct __attribute__((packed)) SectorSummary {
+        uint32_t magic;
+        uint32_t seq;                       // 每進入一個 sector +1
+        uint16_t block[SLOTS_PER_SECTOR];   // 第 i+1 頁存放的邏輯區塊，0xFFFF = 未使用
+    };
+
+    const char* label;
+    const esp_partition_t* part = nullptr;
+    int sectors = 0;
+    int head = 0;           // 寫入中的 sector
+    int headSlot = 0;       // head 中下一個空頁 (1..SLOTS_PER_SECTOR，PAGES_PER_SECTOR = 已滿)
+    uint32_t headSeq = 0;
+    uint16_t pageOf[HISTORY_BLOCK_COUNT]; // 邏輯區塊 -> 實體頁 (sector * PAGES_PER_SECTOR + slot)
+
+    bool readSummary(int sector, SectorSummary& summary);
+    bool enterSector(int sector);
+    bool relocateAfterHead();
+    bool appendPage(int block, const uint8_t* buf);
+};
+
+// 依編譯設定開啟歷史紀錄後端；原始分割區不存在或太小時退回資料檔案系統上的 path
+HistoryStore* openHistoryStore(const char* path);
+// 檔案按需成長：寫入位置超過檔尾時先以 0xFF (空紀錄) 補齊
+bool growFileTo(File& file, size_t offset);
+void runHistoryStoreBenchmark();
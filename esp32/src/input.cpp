@@ -48,8 +48,17 @@ void handleEncoderPush() {
                     updateScreens(); 
                 }
                 else if (isEngineeringMode && (currentPageIndex >= SCREEN_TEMP_CHART && currentPageIndex < SCREEN_SYSTEM)) { 
-                    currentEncoderMode = (currentEncoderMode == MODE_NAVIGATION) ? MODE_VIEW_ADJUST : MODE_NAVIGATION; 
-                    Serial.printf("DEBUG: Toggling chart view mode to %s\n", (currentEncoderMode == MODE_NAVIGATION) ? "NAVIGATION" : "VIEW_ADJUST");
+                    if (currentEncoderMode == MODE_NAVIGATION) {
+                        currentEncoderMode = MODE_VIEW_ADJUST;
+                        Serial.println("DEBUG: Toggling chart view mode to VIEW_ADJUST");
+                    } else {
+                        // 檢視模式中再按一次切換解析度 (原始 30 分 -> 縮放 2h/6h/24h/全部 -> 彙總 1分/1時/1天)，返回鍵離開
+                        chartResolution = (ChartResolution)((chartResolution + 1) % (CHART_DAY + 1));
+                        historyViewOffset = 0;
+                        Serial.printf("DEBUG: Chart resolution changed to %d\n", chartResolution);
+                    }
+                    rotaryEncoder.setBoundaries(0, historyViewMaxOffset(), false);
+                    rotaryEncoder.setEncoderValue(historyViewOffset);
                 }
                 break;
             case UI_MODE_SYSTEM_MENU:
@@ -60,7 +69,7 @@ void handleEncoderPush() {
                         u8g2.clearBuffer(); 
                         u8g2.setFont(u8g2_font_ncenB10_tr); 
                         u8g2.drawStr((128-u8g2.getStrWidth("Starting WiFi..."))/2,38,"Starting WiFi..."); 
-                        u8g2.sendBuffer(); 
+                        sendDisplayFrame(); 
                         delay(1000); 
                         startWiFiConnection(); 
                         returnToMainScreen(); 
@@ -78,7 +87,7 @@ void handleEncoderPush() {
                         u8g2.clearBuffer(); 
                         u8g2.setFont(u8g2_font_ncenB10_tr); 
                         u8g2.drawStr((128-u8g2.getStrWidth("Rebooting..."))/2,38,"Rebooting..."); 
-                        u8g2.sendBuffer(); 
+                        sendDisplayFrame(); 
                         delay(1000); 
                         ESP.restart(); 
                         break;
@@ -146,6 +155,7 @@ void handleBackButton() {
         } else if (currentUIMode == UI_MODE_MAIN_SCREENS && currentEncoderMode == MODE_VIEW_ADJUST) {
             Serial.println("DEBUG: Back button: exiting chart view adjust mode.");
             currentEncoderMode = MODE_NAVIGATION;
+            updateScreens(); // 編碼器範圍改回頁面切換
         } else {
             Serial.println("DEBUG: Back button: returning to time screen.");
             currentPageIndex = SCREEN_TIME;
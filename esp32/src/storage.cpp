@@ -1,82 +1,1042 @@
 
 #include "globals.h"
+#include "history_store.h"
+#include "history_recovery.h"
+#include <esp_system.h>
+#include <stddef.h>
+#include <time.h>
+
+static const char* HISTORY_FILE = "/history.dat";
+static const char* HISTORY_TMP_FILE = "/history.tmp";
+static HistoryStore* historyStore = nullptr; // 區塊環的存放位置 (見 history_store.h)
+static const uint8_t HISTORY_BLOCK_MAGIC = 0xA5;
+static const uint8_t HISTORY_BLOCK_UNSYNCED = 0x01; // baseTime 是開機後的本地時鐘，尚未對時
+
+// 區塊標頭 (16 bytes)，後面接 HISTORY_RECORDS_PER_BLOCK 筆 3-byte 紀錄，未使用的紀錄為 0xFF。
+// 第 i 筆紀錄的時間 = baseTime + i * interval；取樣時間偏離預期超過 HISTORY_TIME_TOLERANCE_S
+// (重開機、斷電、感測器失敗、重新對時) 時改從下一個區塊開始，剩下的紀錄保留為空位。
+// 區塊是自我描述的：seq 每開一個新區塊 +1 (永不歸零)，crc 涵蓋標頭與前 count 筆紀錄，
+// 開機時以二分搜尋找出 seq 最大的有效區塊即為寫入位置，不需要 NVS 裡的指標。
+struct __attribute__((packed)) HistoryBlockHeader {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint8_t interval;     // 紀錄間隔 (秒)
+    uint32_t baseTime;    // 第一筆紀錄的 Unix 時間；UNSYNCED 時為本地時鐘 (以 int32 解讀)
+    uint32_t seq;         // 區塊序號，0 = 無效
+    uint8_t count;        // 已寫入的紀錄數 (含空位)
+    uint8_t reserved;
+    uint16_t crc;         // CRC-16/CCITT，涵蓋 crc 之前的標頭與 count 筆紀錄
+};
+static_assert(sizeof(HistoryBlockHeader) == HISTORY_BLOCK_HEADER_SIZE, "Unexpected history block header size");
+
+// v1 /history.dat 的紀錄格式 (4800 筆環形檔)
+struct LegacyDataPoint {
+    float temp;
+    float hum;
+    int32_t rssi;
+};
+
+// ---- 歷史紀錄暫存區 (Group commit) ----
+// 新樣本先放在 RAM，湊滿一批 (對齊 HISTORY_COMMIT_COUNT 的環形區段) 或
+// 暫存超過 HISTORY_COMMIT_MAX_AGE_MS 才一次寫入 /history.dat。
+// historyIndex / historyCount 包含尚未寫入的暫存樣本，它們永遠是最新的幾筆。
+// 暫存樣本的 time 欄位存的是取樣當下的本地時鐘 (未對時時可能小於 MIN_VALID_EPOCH)。
+static DataPoint historyStaging[HISTORY_COMMIT_COUNT];
+static int historyStagedCount = 0;
+static unsigned long historyOldestStagedTime = 0;
+
+// ---- 目前寫入中的區塊 ----
+// 每次提交都把整個區塊 (標頭 + 已提交與新提交的紀錄) 重新寫成一頁，RAM 中保留該區塊的映像。
+static bool historyBlockOpen = false;   // 開機後的第一筆一律從新區塊開始
+static uint32_t historyBlockBaseTime = 0;
+static uint8_t historyBlockFlags = 0;
+static uint32_t historyBlockSeq = 0;
+static uint32_t historyNextBlockSeq = 1;
+static uint8_t historyBlockImage[HISTORY_BLOCK_SIZE];
+
+// ---- 未對時紀錄的修正 ----
+// 對時前的樣本以本地時鐘記錄；時鐘跳到有效時間後，依最後一次取樣時的時鐘與 millis()
+// 算出偏移量，回頭修正本次開機寫入的 UNSYNCED 區塊。
+static int historyUnsyncedSlot = -1;    // 本次開機第一筆未對時紀錄的 slot，-1 = 無
+static time_t historyClockAnchor = 0;
+static unsigned long historyClockAnchorMillis = 0;
+
+// ---- 圖表視窗快取 ----
+// historyWindowBuffer 以「樣本序號」(開機後累計) 記錄目前內容，畫面每幀呼叫
+// loadHistoryWindow() 時若視窗沒變就完全不碰 flash；捲動時只補讀新進入畫面的紀錄。
+static uint32_t historyHeadSeq = 0;        // 下一筆新樣本的序號
+static uint32_t historyWindowFirstSeq = 0; // historyWindowBuffer[0] 的序號
+static int historyWindowPoints = 0;        // 快取中的有效筆數，0 = 無效
+
+static void flushStorageOnShutdown();
+static void keepHistoryViewStill(uint32_t previousHeadSeq);
+
+static uint8_t historyIntervalSec() {
+    return historyRecordInterval / 1000;
+}
+
+// 3-byte 紀錄: bit 0-9 溫度 (0.1°C，偏移 -20.0°C)，bit 10-16 濕度 (%)，bit 17-23 RSSI (-dBm)。
+// DHT11 的解析度為 0.1°C / 1%，因此不會損失精度；濕度最大 100，全 1 的 0xFFFFFF 永遠代表空位。
+static void packDataPoint(float temp, float hum, long rssi, uint8_t* out) {
+    uint32_t t = constrain(lroundf((temp + 20.0f) * 10.0f), 0L, 1023L);
+    uint32_t h = constrain(lroundf(hum), 0L, 100L);
+    uint32_t r = constrain(-rssi, 0L, 127L);
+    uint32_t v = t | (h << 10) | (r << 17);
+    out[0] = v & 0xFF;
+    out[1] = (v >> 8) & 0xFF;
+    out[2] = (v >> 16) & 0xFF;
+}
+
+// 空位解成 temp/hum = NAN，呼叫端以 isnan(dp.temp) 判斷
+static void unpackDataPoint(const uint8_t* in, DataPoint& dp) {
+    uint32_t v = in[0] | (in[1] << 8) | ((uint32_t)in[2] << 16);
+    if (v == 0xFFFFFF) {
+        dp.temp = NAN;
+        dp.hum = NAN;
+        dp.rssi = 0;
+        return;
+    }
+    dp.temp = (v & 0x3FF) / 10.0f - 20.0f;
+    dp.hum = (v >> 10) & 0x7F;
+    dp.rssi = -(long)((v >> 17) & 0x7F);
+}
+
+static uint32_t blockRecordTime(const HistoryBlockHeader& hdr, int slotInBlock) {
+    if (hdr.magic != HISTORY_BLOCK_MAGIC || hdr.interval == 0 || (hdr.flags & HISTORY_BLOCK_UNSYNCED)) return 0;
+    return hdr.baseTime + slotInBlock * hdr.interval;
+}
+
+static void setBlockHeader(uint8_t* block, uint32_t baseTime, uint8_t flags, uint32_t seq) {
+    HistoryBlockHeader* hdr = (HistoryBlockHeader*)block;
+    memset(hdr, 0, sizeof(HistoryBlockHeader));
+    hdr->magic = HISTORY_BLOCK_MAGIC;
+    hdr->version = HISTORY_FORMAT_VERSION;
+    hdr->flags = flags;
+    hdr->interval = historyIntervalSec();
+    hdr->baseTime = baseTime;
+    hdr->seq = seq;
+}
+
+static uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF) {
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+static uint16_t blockCrc(const uint8_t* block, int count) {
+    uint16_t crc = crc16(block, offsetof(HistoryBlockHeader, crc));
+    return crc16(block + HISTORY_BLOCK_HEADER_SIZE, count * HISTORY_RECORD_SIZE, crc);
+}
+
+// 更新紀錄數並重算 CRC，寫入前呼叫
+static void sealBlock(uint8_t* block, int count) {
+    HistoryBlockHeader* hdr = (HistoryBlockHeader*)block;
+    hdr->count = count;
+    hdr->crc = blockCrc(block, count);
+}
+
+// 讀取第 b 個區塊並驗證，回傳 seq；從未寫入、舊版格式或寫入途中斷電的區塊回傳 0。
+static uint32_t readValidBlock(int b, uint8_t* block) {
+    if (!historyStore->read(b, 0, block, HISTORY_BLOCK_SIZE)) return 0;
+    const HistoryBlockHeader* hdr = (const HistoryBlockHeader*)block;
+    if (hdr->magic != HISTORY_BLOCK_MAGIC || hdr->version != HISTORY_FORMAT_VERSION) return 0;
+    if (hdr->count == 0 || hdr->count > HISTORY_RECORDS_PER_BLOCK || hdr->seq == 0) return 0;
+    if (hdr->crc != blockCrc(block, hdr->count)) return 0;
+    return hdr->seq;
+}
+
+// recoverHistoryHead() 的讀取方式 (見 history_recovery.h)
+static uint32_t probeHistoryBlock(void*, int b, uint16_t& count) {
+    uint8_t block[HISTORY_BLOCK_SIZE];
+    uint32_t seq = readValidBlock(b, block);
+    count = ((const HistoryBlockHeader*)block)->count;
+    return seq;
+}
+
+// 寫入位置改由區塊標頭還原，舊版的 NVS 指標在轉換完成後移除
+static void saveHistoryFormat() {
+    preferences.begin("medbox-meta", false);
+    preferences.putUChar("hist_ver", HISTORY_FORMAT_VERSION);
+    preferences.remove("hist_count");
+    preferences.remove("hist_index");
+    preferences.remove("last_temp");
+    preferences.remove("last_hum");
+    preferences.end();
+}
+
+// 舊格式沒有時間資訊，只能沿用舊韌體的假設：紀錄連續、最後一筆約在現在。
+// 若尚未對時則標記 UNSYNCED，等本次開機對時後一併修正。
+static uint32_t legacyRecordTime(int k, int total, time_t now) {
+    return (uint32_t)(now - (time_t)(total - 1 - k) * historyIntervalSec());
+}
+
+static uint8_t legacyBlockFlags(time_t now) {
+    if (now >= MIN_VALID_EPOCH) return 0;
+    historyClockAnchor = now;
+    historyClockAnchorMillis = millis();
+    return HISTORY_BLOCK_UNSYNCED;
+}
+
+// 將 v1 (4800 x 12B DataPoint 環形檔) 依時間順序轉成區塊格式。
+// 先寫入 /history.tmp 再取代原檔，過程中斷電下次開機會重新執行。
+static void migrateV1HistoryFile(int legacyCount, int legacyIndex) {
+    if (DATA_FS.exists(HISTORY_TMP_FILE)) {
+        if (!DATA_FS.exists(HISTORY_FILE)) {
+            // 舊檔已刪除但尚未改名，新檔已完整寫好
+            Serial.println("DEBUG: Completing interrupted history migration.");
+            DATA_FS.rename(HISTORY_TMP_FILE, HISTORY_FILE);
+            saveHistoryFormat();
+            return;
+        }
+        DATA_FS.remove(HISTORY_TMP_FILE);
+    }
+    if (!DATA_FS.exists(HISTORY_FILE)) return;
+
+    Serial.printf("DEBUG: Migrating /history.dat v1 -> v%d (%d records).\n", HISTORY_FORMAT_VERSION, legacyCount);
+    unsigned long startTime = millis();
+    File src = DATA_FS.open(HISTORY_FILE, "r");
+    File dst = DATA_FS.open(HISTORY_TMP_FILE, FILE_WRITE);
+    if (!src || !dst) {
+        Serial.println("DEBUG: Failed to open files for history migration.");
+        if (src) src.close();
+        if (dst) dst.close();
+        return;
+    }
+    legacyCount = constrain(legacyCount, 0, LEGACY_MAX_HISTORY);
+    legacyIndex = constrain(legacyIndex, 0, LEGACY_MAX_HISTORY - 1);
+    int legacyStart = (legacyIndex - legacyCount + LEGACY_MAX_HISTORY) % LEGACY_MAX_HISTORY;
+    time_t now = time(nullptr);
+    uint8_t flags = legacyBlockFlags(now);
+    uint8_t block[HISTORY_BLOCK_SIZE];
+    LegacyDataPoint chunk[20];
+    int converted = 0;
+    for (int b = 0; b < HISTORY_BLOCK_COUNT; b++) {
+        int inBlock = min(HISTORY_RECORDS_PER_BLOCK, max(0, legacyCount - converted));
+        memset(block, 0xFF, sizeof(block));
+        if (inBlock > 0) {
+            setBlockHeader(block, legacyRecordTime(converted, legacyCount, now), flags, b + 1);
+        }
+        for (int i = 0; i < inBlock; i += 20) {
+            int n = min(20, inBlock - i);
+            for (int k = 0; k < n; k++) {
+                // 舊檔一次讀一段連續範圍，跨過檔尾時分兩段
+                int slot = (legacyStart + converted + i + k) % LEGACY_MAX_HISTORY;
+                if (k == 0 || slot == 0) {
+                    int run = min(n - k, LEGACY_MAX_HISTORY - slot);
+                    src.seek(slot * sizeof(LegacyDataPoint));
+                    src.read((uint8_t*)&chunk[k], run * sizeof(LegacyDataPoint));
+                }
+                packDataPoint(chunk[k].temp, chunk[k].hum, chunk[k].rssi, block + HISTORY_BLOCK_HEADER_SIZE + (i + k) * HISTORY_RECORD_SIZE);
+            }
+        }
+        if (inBlock > 0) sealBlock(block, inBlock);
+        converted += inBlock;
+        dst.write(block, HISTORY_BLOCK_SIZE);
+    }
+    src.close();
+    dst.close();
+    DATA_FS.remove(HISTORY_FILE);
+    DATA_FS.rename(HISTORY_TMP_FILE, HISTORY_FILE);
+    saveHistoryFormat();
+    if (flags & HISTORY_BLOCK_UNSYNCED && converted > 0) historyUnsyncedSlot = 0;
+    Serial.printf("DEBUG: History migration done in %lu ms.\n", millis() - startTime);
+}
+
+static void migrateHistoryFile() {
+    preferences.begin("medbox-meta", true);
+    uint8_t version = preferences.getUChar("hist_ver", 1);
+    int count = preferences.getInt("hist_count", 0);
+    int index = preferences.getInt("hist_index", 0);
+    preferences.end();
+    if (version == 1) migrateV1HistoryFile(count, index);
+}
 
 void initializeHistoryFile() {
     Serial.println("DEBUG: initializeHistoryFile");
-    if (!SPIFFS.exists("/history.dat")) {
-        Serial.println("DEBUG: /history.dat not found, creating new file.");
-        File file = SPIFFS.open("/history.dat", FILE_WRITE); 
+#ifndef HISTORY_USE_PARTITION
+    // 舊版格式只存在於檔案系統上；原始分割區後端從空的日誌開始
+    migrateHistoryFile();
+#endif
+    historyStore = openHistoryStore(HISTORY_FILE);
+    saveHistoryFormat();
+    Serial.printf("DEBUG: History store: %s\n", historyStore->name());
+}
+
+// 由區塊標頭還原寫入位置。區塊依環形順序寫入，seq 在實體位置上是「遞增後回繞」的序列，
+// 無效區塊 (未寫入或寫入中斷電) 只會出現在最舊的一端或緊接在最新區塊之後，視為 0 不影響單調性，
+// 因此能以二分搜尋找出 seq 最大的區塊：約 log2(HISTORY_BLOCK_COUNT) 次區塊讀取。
+void loadHistoryMetadata() {
+    Serial.println("DEBUG: loadHistoryMetadata");
+    historyCount = 0;
+    historyIndex = 0;
+    if (historyStore->open(false)) {
+        HistoryHead h = recoverHistoryHead(HISTORY_BLOCK_COUNT, HISTORY_RECORDS_PER_BLOCK, probeHistoryBlock, nullptr);
+        if (h.head >= 0) {
+            historyCount = h.count;
+            historyIndex = h.index;
+            historyNextBlockSeq = h.headSeq + 1;
+            Serial.printf("DEBUG: History head recovered at block %d (seq %lu) with %d block reads.\n", h.head, (unsigned long)h.headSeq, h.reads);
+        }
+        historyStore->close();
+    }
+    historyHeadSeq = historyCount;
+    Serial.printf("DEBUG: Loaded history metadata - Count: %d, Index: %d\n", historyCount, historyIndex);
+    // ESP.restart() / esp_restart() 前先把暫存樣本與設定值寫入 flash
+    esp_register_shutdown_handler(flushStorageOnShutdown);
+}
+
+static void logHistoryWriteCost() {
+    if (historyWriteStats.samples == 0) return;
+    float samples = historyWriteStats.samples;
+    // page 與抹除次數只有直接操作 flash 的後端量得到；檔案系統與 NVS 只記錄寫入次數
+    const HistoryStoreStats& store = historyStore->stats();
+    Serial.printf("DEBUG: History write cost (%s) - %lu samples, %lu commits, %.2f NVS writes/sample, avg commit %lu us",
+                  historyStore->name(), historyWriteStats.samples, historyWriteStats.commits,
+                  historyWriteStats.nvsWrites / samples, store.writeMicros / max(1UL, (unsigned long)store.writes));
+    if (store.flashMeasured) {
+        Serial.printf(", %.2f pages/sample, %.3f erases/sample\n", store.pagesProgrammed / samples, store.erases / samples);
+    } else {
+        Serial.println(", flash pages/erases not measured");
+    }
+}
+
+// ---- 多解析度彙總 (min/max/mean) ----
+// 每層一個環形檔，bucket 依起始時間直接定址 (slot = bucket 序號 % 容量)，不需要額外的索引 metadata；
+// 讀取時以紀錄內的 start 驗證，舊一輪或從未寫入的 slot 視為空 bucket。
+// 每筆樣本對每層只更新一次開啟中的累加器 (O(1))，結束的 bucket 先放在 RAM，隨歷史紀錄一起寫入。
+struct RollupAccumulator {
+    RollupBucket bucket;  // mean 欄位在結束時才計算
+    int32_t tempSum, humSum, rssiSum;
+};
+
+struct PendingRollup {
+    uint8_t tier;
+    RollupBucket bucket;
+};
+
+static const char* ROLLUP_FILES[ROLLUP_TIER_COUNT] = {"/rollup_m.dat", "/rollup_h.dat", "/rollup_d.dat"};
+static const uint32_t ROLLUP_PERIODS[ROLLUP_TIER_COUNT] = {60, 3600, 86400};
+static const int ROLLUP_SLOTS[ROLLUP_TIER_COUNT] = {ROLLUP_MINUTE_SLOTS, ROLLUP_HOUR_SLOTS, ROLLUP_DAY_SLOTS};
+static RollupAccumulator rollupOpen[ROLLUP_TIER_COUNT];
+static PendingRollup rollupPending[ROLLUP_PENDING_MAX];
+static int rollupPendingCount = 0;
+static uint32_t rollupGeneration = 0; // 每次彙總內容改變 +1，供圖表快取判斷
+
+uint32_t rollupPeriod(RollupTier tier) {
+    return ROLLUP_PERIODS[tier];
+}
+
+int rollupCapacity(RollupTier tier) {
+    return ROLLUP_SLOTS[tier];
+}
+
+// 以當地時間對齊，日 bucket 從午夜開始
+static uint32_t rollupBucketStart(int tier, uint32_t t) {
+    uint32_t p = ROLLUP_PERIODS[tier];
+    return ((t + GMT_OFFSET) / p) * p - GMT_OFFSET;
+}
+
+static int rollupSlot(int tier, uint32_t start) {
+    return ((start + GMT_OFFSET) / ROLLUP_PERIODS[tier]) % ROLLUP_SLOTS[tier];
+}
+
+static RollupBucket finishRollupBucket(const RollupAccumulator& acc) {
+    RollupBucket b = acc.bucket;
+    if (b.count > 0) {
+        b.tempMean = acc.tempSum / b.count;
+        b.humMean = acc.humSum / b.count;
+        b.rssiMean = acc.rssiSum / b.count;
+    }
+    return b;
+}
+
+// 與 /history.dat 相同，只建立空檔，寫到哪裡才長到哪裡
+void initializeRollupFiles() {
+    for (int tier = 0; tier < ROLLUP_TIER_COUNT; tier++) {
+        if (DATA_FS.exists(ROLLUP_FILES[tier])) continue;
+        Serial.printf("DEBUG: %s not found, creating new file.\n", ROLLUP_FILES[tier]);
+        File file = DATA_FS.open(ROLLUP_FILES[tier], FILE_WRITE);
         if (!file) {
-            Serial.println("DEBUG: Failed to create /history.dat");
-            return;
+            Serial.printf("DEBUG: Failed to create %s\n", ROLLUP_FILES[tier]);
+            continue;
         }
-        DataPoint empty = {0, 0, 0}; 
-        for (int i = 0; i < MAX_HISTORY; i++) { 
-            file.write((uint8_t*)&empty, sizeof(DataPoint)); 
-        } 
         file.close();
-        Serial.println("DEBUG: /history.dat created successfully.");
+    }
+}
+
+static void writeRollupRun(File& file, int slot, const RollupBucket* run, int len) {
+    if (len == 0 || !growFileTo(file, slot * sizeof(RollupBucket))) return;
+    file.seek(slot * sizeof(RollupBucket));
+    file.write((const uint8_t*)run, len * sizeof(RollupBucket));
+    historyWriteStats.bytesWritten += len * sizeof(RollupBucket);
+}
+
+// 寫入已結束的 bucket 與目前開啟中的 bucket (部分結果，斷電後開機會接續累加)。
+// 連續 slot 合併成一次寫入；每層最多開檔一次。
+static void flushRollups() {
+    for (int tier = 0; tier < ROLLUP_TIER_COUNT; tier++) {
+        if (rollupOpen[tier].bucket.count == 0 && rollupPendingCount == 0) continue;
+        File file = DATA_FS.open(ROLLUP_FILES[tier], "r+");
+        if (!file) {
+            Serial.printf("DEBUG: Failed to open %s for commit.\n", ROLLUP_FILES[tier]);
+            continue;
+        }
+        RollupBucket run[16];
+        int runSlot = 0, runLen = 0;
+        for (int i = 0; i <= rollupPendingCount; i++) {
+            RollupBucket b;
+            if (i < rollupPendingCount) {
+                if (rollupPending[i].tier != tier) continue;
+                b = rollupPending[i].bucket;
+            } else {
+                if (rollupOpen[tier].bucket.count == 0) break;
+                b = finishRollupBucket(rollupOpen[tier]);
+            }
+            int slot = rollupSlot(tier, b.start);
+            if (runLen == 16 || (runLen > 0 && slot != runSlot + runLen)) {
+                writeRollupRun(file, runSlot, run, runLen);
+                runLen = 0;
+            }
+            if (runLen == 0) runSlot = slot;
+            run[runLen++] = b;
+        }
+        writeRollupRun(file, runSlot, run, runLen);
+        file.close();
+    }
+    rollupPendingCount = 0;
+}
+
+// 讀出 start 對應的已儲存 bucket；slot 屬於其他時段時回傳 false
+static bool readStoredRollup(int tier, uint32_t start, RollupBucket& out) {
+    File file = DATA_FS.open(ROLLUP_FILES[tier], "r");
+    if (!file) return false;
+    file.seek(rollupSlot(tier, start) * sizeof(RollupBucket));
+    bool ok = file.read((uint8_t*)&out, sizeof(out)) == sizeof(out) && out.start == start && out.count > 0 && out.count != 0xFFFF;
+    file.close();
+    return ok;
+}
+
+static void openRollupBucket(int tier, uint32_t start) {
+    RollupAccumulator& acc = rollupOpen[tier];
+    uint32_t prevStart = acc.bucket.start;
+    memset(&acc, 0, sizeof(acc));
+    acc.bucket.start = start;
+    if (prevStart != 0 && start == prevStart + ROLLUP_PERIODS[tier]) return;
+    // 開機後或時間不連續：這個時段可能已有先前寫入的部分結果，接續累加
+    flushRollups();
+    RollupBucket stored;
+    if (readStoredRollup(tier, start, stored)) {
+        acc.bucket = stored;
+        acc.tempSum = (int32_t)stored.tempMean * stored.count;
+        acc.humSum = (int32_t)stored.humMean * stored.count;
+        acc.rssiSum = (int32_t)stored.rssiMean * stored.count;
+        Serial.printf("DEBUG: Resuming %s bucket at %lu with %u samples.\n", ROLLUP_FILES[tier], (unsigned long)start, stored.count);
+    }
+}
+
+static void closeRollupBucket(int tier) {
+    if (rollupPendingCount >= ROLLUP_PENDING_MAX) flushRollups();
+    rollupPending[rollupPendingCount].tier = tier;
+    rollupPending[rollupPendingCount].bucket = finishRollupBucket(rollupOpen[tier]);
+    rollupPendingCount++;
+    rollupOpen[tier].bucket.count = 0;
+}
+
+static void updateRollups(float temp, float hum, long rssi, uint32_t now) {
+    int16_t t = lroundf(temp * 100);
+    int16_t h = lroundf(hum * 100);
+    int16_t r = rssi;
+    for (int tier = 0; tier < ROLLUP_TIER_COUNT; tier++) {
+        uint32_t start = rollupBucketStart(tier, now);
+        RollupAccumulator& acc = rollupOpen[tier];
+        if (acc.bucket.start != start) {
+            if (acc.bucket.count > 0) closeRollupBucket(tier);
+            openRollupBucket(tier, start);
+        }
+        RollupBucket& b = acc.bucket;
+        if (b.count == 0) {
+            b.tempMin = b.tempMax = t;
+            b.humMin = b.humMax = h;
+            b.rssiMin = b.rssiMax = r;
+        } else {
+            b.tempMin = min(b.tempMin, t); b.tempMax = max(b.tempMax, t);
+            b.humMin = min(b.humMin, h); b.humMax = max(b.humMax, h);
+            b.rssiMin = min(b.rssiMin, r); b.rssiMax = max(b.rssiMax, r);
+        }
+        b.count++;
+        acc.tempSum += t;
+        acc.humSum += h;
+        acc.rssiSum += r;
+    }
+    rollupGeneration++;
+}
+
+// 讀取 tier 中以 endTime 所在 bucket 結尾的 count 個 bucket (out[0] 最舊)。
+// 已儲存的部分最多兩次連續讀取 (環形檔尾端折返)，再疊上尚未寫入的 bucket 與開啟中的 bucket。
+// 沒有資料的時段 count = 0。回傳 bucket 數。
+int readRollupRange(RollupTier tier, uint32_t endTime, int count, RollupBucket* out) {
+    count = constrain(count, 0, ROLLUP_SLOTS[tier]);
+    if (count == 0 || endTime < MIN_VALID_EPOCH) return 0;
+    uint32_t p = ROLLUP_PERIODS[tier];
+    uint32_t firstStart = rollupBucketStart(tier, endTime) - (count - 1) * p;
+    File file = DATA_FS.open(ROLLUP_FILES[tier], "r");
+    bool stored = file;
+    if (stored) {
+        memset(out, 0xFF, count * sizeof(RollupBucket)); // 檔尾之後讀不到的部分視為空
+        int slot = rollupSlot(tier, firstStart);
+        int run = min(count, ROLLUP_SLOTS[tier] - slot);
+        file.seek(slot * sizeof(RollupBucket));
+        file.read((uint8_t*)out, run * sizeof(RollupBucket));
+        if (run < count) {
+            file.seek(0);
+            file.read((uint8_t*)&out[run], (count - run) * sizeof(RollupBucket));
+        }
+        file.close();
+    }
+    for (int i = 0; i < count; i++) {
+        uint32_t start = firstStart + i * p;
+        if (!stored || out[i].start != start || out[i].count == 0xFFFF) {
+            memset(&out[i], 0, sizeof(RollupBucket));
+            out[i].start = start;
+        }
+    }
+    for (int i = 0; i <= rollupPendingCount; i++) {
+        RollupBucket b;
+        if (i < rollupPendingCount) {
+            if (rollupPending[i].tier != tier) continue;
+            b = rollupPending[i].bucket;
+        } else {
+            if (rollupOpen[tier].bucket.count == 0) break;
+            b = finishRollupBucket(rollupOpen[tier]);
+        }
+        if (b.start < firstStart) continue;
+        uint32_t k = (b.start - firstStart) / p;
+        if (k < (uint32_t)count) out[k] = b;
+    }
+    return count;
+}
+
+void flushHistory() {
+    flushRollups();
+    if (historyStagedCount == 0) return;
+    if (!historyStore->open(true)) {
+        Serial.println("DEBUG: Failed to open /history.dat for commit.");
+        return;
+    }
+    // 暫存批次不會跨越區塊 (見 HISTORY_COMMIT_COUNT 與 startNextHistoryBlock)。
+    // 整頁寫入 (標頭 + 紀錄 + 0xFF 空位)，新區塊一併覆蓋上一輪的舊資料；
+    // 寫到一半斷電時 CRC 不符，開機時退回上一個完整的區塊。
+    int firstSlot = (historyIndex - historyStagedCount + MAX_HISTORY) % MAX_HISTORY;
+    int block = firstSlot / HISTORY_RECORDS_PER_BLOCK;
+    int slotInBlock = firstSlot % HISTORY_RECORDS_PER_BLOCK;
+    uint8_t buf[HISTORY_BLOCK_SIZE];
+    memcpy(buf, historyBlockImage, sizeof(buf));
+    setBlockHeader(buf, historyBlockBaseTime, historyBlockFlags, historyBlockSeq);
+    for (int i = 0; i < historyStagedCount; i++) {
+        packDataPoint(historyStaging[i].temp, historyStaging[i].hum, historyStaging[i].rssi,
+                      buf + HISTORY_BLOCK_HEADER_SIZE + (slotInBlock + i) * HISTORY_RECORD_SIZE);
+    }
+    sealBlock(buf, slotInBlock + historyStagedCount);
+    size_t bytes = HISTORY_BLOCK_SIZE;
+    bool written = historyStore->writeBlock(block, buf);
+    historyStore->close();
+    if (!written) {
+        Serial.printf("DEBUG: History commit to block %d failed, will retry.\n", block);
+        return;
+    }
+    Serial.printf("DEBUG: Committed %d history points at index %d. Count: %d\n", historyStagedCount, firstSlot, historyCount);
+    memcpy(historyBlockImage, buf, sizeof(buf));
+    historyStagedCount = 0;
+
+    historyWriteStats.commits++;
+    historyWriteStats.bytesWritten += bytes;
+    logHistoryWriteCost();
+}
+
+// 時鐘從未對時跳到有效時間後，修正暫存區、寫入中的區塊與本次開機已提交的 UNSYNCED 區塊。
+static void fixupUnsyncedHistory() {
+    if (historyUnsyncedSlot < 0) return;
+    time_t now = time(nullptr);
+    if (now < MIN_VALID_EPOCH) return;
+    int32_t delta = now - (historyClockAnchor + (time_t)((millis() - historyClockAnchorMillis) / 1000));
+    Serial.printf("DEBUG: Clock synced, shifting unsynced history by %ld s.\n", (long)delta);
+    for (int i = 0; i < historyStagedCount; i++) {
+        if (historyStaging[i].time < MIN_VALID_EPOCH) historyStaging[i].time += delta;
+    }
+    if (historyBlockOpen && (historyBlockFlags & HISTORY_BLOCK_UNSYNCED)) {
+        historyBlockBaseTime += delta;
+        historyBlockFlags &= ~HISTORY_BLOCK_UNSYNCED;
+    }
+    if (historyStore->open(true)) {
+        int firstBlock = historyUnsyncedSlot / HISTORY_RECORDS_PER_BLOCK;
+        int headBlock = ((historyIndex - 1 + MAX_HISTORY) % MAX_HISTORY) / HISTORY_RECORDS_PER_BLOCK;
+        uint8_t block[HISTORY_BLOCK_SIZE];
+        HistoryBlockHeader* hdr = (HistoryBlockHeader*)block;
+        for (int b = firstBlock; ; b = (b + 1) % HISTORY_BLOCK_COUNT) {
+            if (readValidBlock(b, block) && (hdr->flags & HISTORY_BLOCK_UNSYNCED)) {
+                hdr->baseTime += delta;
+                hdr->flags &= ~HISTORY_BLOCK_UNSYNCED;
+                sealBlock(block, hdr->count);
+                historyStore->writeBlock(b, block);
+            }
+            if (b == headBlock) break;
+        }
+        historyStore->close();
+    }
+    historyUnsyncedSlot = -1;
+    historyWindowPoints = 0; // 重新讀取以取得修正後的時間
+}
+
+void handleHistoryCommit() {
+    fixupUnsyncedHistory();
+    if (historyStagedCount > 0 && millis() - historyOldestStagedTime >= HISTORY_COMMIT_MAX_AGE_MS) {
+        Serial.println("DEBUG: History staging max age reached, committing.");
+        flushHistory();
+    }
+}
+
+static void flushStorageOnShutdown() {
+    flushHistory();
+    flushSettings();
+}
+
+static void pushHistoryWindow(const DataPoint& dp) {
+    if (historyWindowPoints == 0 || historyWindowFirstSeq + historyWindowPoints != historyHeadSeq) return;
+    if (historyWindowPoints < HISTORY_WINDOW_SIZE) {
+        historyWindowBuffer[historyWindowPoints++] = dp;
     } else {
-        Serial.println("DEBUG: /history.dat already exists.");
+        memmove(&historyWindowBuffer[0], &historyWindowBuffer[1], (HISTORY_WINDOW_SIZE - 1) * sizeof(DataPoint));
+        historyWindowBuffer[HISTORY_WINDOW_SIZE - 1] = dp;
+        historyWindowFirstSeq++;
     }
 }
 
-void loadHistoryMetadata() {
-    Serial.println("DEBUG: loadHistoryMetadata");
-    preferences.begin("medbox-meta", true);
-    historyCount = preferences.getInt("hist_count", 0);
-    historyIndex = preferences.getInt("hist_index", 0);
-    preferences.end();
-    Serial.printf("DEBUG: Loaded history metadata - Count: %d, Index: %d\n", historyCount, historyIndex);
+// 關閉目前的區塊：先提交暫存樣本，再把寫入位置移到下一個區塊開頭，中間留下空位。
+static bool startNextHistoryBlock() {
+    flushHistory();
+    if (historyStagedCount > 0) return false;
+    int skipped = (HISTORY_RECORDS_PER_BLOCK - historyIndex % HISTORY_RECORDS_PER_BLOCK) % HISTORY_RECORDS_PER_BLOCK;
+    historyIndex = (historyIndex + skipped) % MAX_HISTORY;
+    historyCount = min(historyCount + skipped, MAX_HISTORY);
+    historyHeadSeq += skipped;
+    keepHistoryViewStill(historyHeadSeq - skipped);
+    historyWindowPoints = 0; // 空位讀取時會解成 NAN
+    historyBlockOpen = false;
+    return true;
 }
 
 void addDataToHistory(float temp, float hum, int16_t rssi) {
     Serial.println("DEBUG: addDataToHistory");
-    File file = SPIFFS.open("/history.dat", "r+");
-    if (!file) {
-        Serial.println("DEBUG: Failed to open /history.dat for writing.");
-        return;
+    time_t now = time(nullptr);
+    bool synced = now >= MIN_VALID_EPOCH;
+    int slotInBlock = historyIndex % HISTORY_RECORDS_PER_BLOCK;
+    if (slotInBlock != 0) {
+        bool continuous = historyBlockOpen && synced == !(historyBlockFlags & HISTORY_BLOCK_UNSYNCED);
+        if (continuous) {
+            int32_t drift = (int32_t)((uint32_t)now - (historyBlockBaseTime + slotInBlock * historyIntervalSec()));
+            continuous = abs(drift) <= HISTORY_TIME_TOLERANCE_S;
+            if (!continuous) Serial.printf("DEBUG: History time drift %ld s, starting new block.\n", (long)drift);
+        }
+        if (!continuous && !startNextHistoryBlock()) {
+            Serial.println("DEBUG: History commit failed, sample dropped.");
+            return;
+        }
     }
-    DataPoint dp = {temp, hum, rssi};
-    file.seek(historyIndex * sizeof(DataPoint));
-    file.write((uint8_t*)&dp, sizeof(DataPoint));
-    file.close();
+    if (historyStagedCount >= HISTORY_COMMIT_COUNT) {
+        flushHistory();
+        if (historyStagedCount >= HISTORY_COMMIT_COUNT) {
+            Serial.println("DEBUG: History staging full and commit failed, sample dropped.");
+            return;
+        }
+    }
+    if (historyIndex % HISTORY_RECORDS_PER_BLOCK == 0) {
+        historyBlockOpen = true;
+        historyBlockBaseTime = (uint32_t)now;
+        historyBlockFlags = synced ? 0 : HISTORY_BLOCK_UNSYNCED;
+        historyBlockSeq = historyNextBlockSeq++;
+        memset(historyBlockImage, 0xFF, sizeof(historyBlockImage));
+    }
+    if (!synced) {
+        if (historyUnsyncedSlot < 0) historyUnsyncedSlot = historyIndex;
+        historyClockAnchor = now;
+        historyClockAnchorMillis = millis();
+    }
+    if (historyStagedCount == 0) historyOldestStagedTime = millis();
+    DataPoint dp = {temp, hum, rssi, (uint32_t)now};
+    historyStaging[historyStagedCount++] = dp;
+    if (!synced) dp.time = 0;
+    pushHistoryWindow(dp);
+    historyHeadSeq++;
     historyIndex = (historyIndex + 1) % MAX_HISTORY;
     if (historyCount < MAX_HISTORY) historyCount++;
-    Serial.printf("DEBUG: Added data to history at index %d. New count: %d\n", (historyIndex - 1 + MAX_HISTORY) % MAX_HISTORY, historyCount);
-    preferences.begin("medbox-meta", false);
-    preferences.putInt("hist_count", historyCount);
-    preferences.putInt("hist_index", historyIndex);
-    preferences.putFloat("last_temp", temp);
-    preferences.putFloat("last_hum", hum);
-    preferences.end();
+    historyWriteStats.samples++;
+    Serial.printf("DEBUG: Staged history point %d/%d. New count: %d\n", historyStagedCount, HISTORY_COMMIT_COUNT, historyCount);
+    // 批次邊界對齊環形緩衝區，確保一次寫入不會跨越檔案尾端
+    if (historyStagedCount >= HISTORY_COMMIT_COUNT || historyIndex % HISTORY_COMMIT_COUNT == 0) {
+        flushHistory();
+    }
+    if (synced) updateRollups(temp, hum, rssi, now);
+    // 正在檢視過去資料時讓畫面停在原處，快取內容仍然有效
+    keepHistoryViewStill(historyHeadSeq - 1);
+    int maxOffset = historyViewMaxOffset();
     if (currentEncoderMode == MODE_VIEW_ADJUST) {
-        int maxOffset = max(0, historyCount - HISTORY_WINDOW_SIZE);
         rotaryEncoder.setBoundaries(0, maxOffset, false);
+        rotaryEncoder.setEncoderValue(historyViewOffset);
+    }
+}
+
+// 讀取第 first 筆起 (0 = 最舊) 的 count 筆紀錄；已提交的部分每個區塊只做一次連續讀取
+// (標頭 + 所需紀錄)，仍在暫存區的最新樣本直接從 RAM 複製。回傳實際讀到的筆數。
+// 空位的 temp 為 NAN；time 為 0 代表時間未知 (未對時)。
+int readHistoryRange(int first, int count, DataPoint* out) {
+    if (first < 0 || count <= 0 || first >= historyCount) return 0;
+    count = min(count, historyCount - first);
+    int committedCount = historyCount - historyStagedCount;
+    int fromFile = max(0, min(count, committedCount - first));
+    if (fromFile > 0) {
+        if (!historyStore->open(false)) {
+            Serial.println("DEBUG: Failed to open /history.dat for reading.");
+            return 0;
+        }
+        uint8_t buf[HISTORY_BLOCK_SIZE];
+        const HistoryBlockHeader* hdr = (const HistoryBlockHeader*)buf;
+        int slot = (historyIndex - historyCount + first + MAX_HISTORY) % MAX_HISTORY;
+        for (int done = 0; done < fromFile; ) {
+            int slotInBlock = slot % HISTORY_RECORDS_PER_BLOCK;
+            int run = min(fromFile - done, HISTORY_RECORDS_PER_BLOCK - slotInBlock);
+            // 尚未寫入的部分讀回 0xFF (空位)
+            historyStore->read(slot / HISTORY_RECORDS_PER_BLOCK, 0, buf, HISTORY_BLOCK_HEADER_SIZE + (slotInBlock + run) * HISTORY_RECORD_SIZE);
+            for (int i = 0; i < run; i++) {
+                DataPoint& dp = out[done + i];
+                unpackDataPoint(buf + HISTORY_BLOCK_HEADER_SIZE + (slotInBlock + i) * HISTORY_RECORD_SIZE, dp);
+                dp.time = isnan(dp.temp) ? 0 : blockRecordTime(*hdr, slotInBlock + i);
+            }
+            done += run;
+            slot = (slot + run) % MAX_HISTORY;
+        }
+        historyStore->close();
+    }
+    for (int i = fromFile; i < count; i++) {
+        out[i] = historyStaging[first + i - committedCount];
+        if (out[i].time < MIN_VALID_EPOCH) out[i].time = 0;
+    }
+    return count;
+}
+
+// 第 index 筆紀錄 (0 = 最舊) 依所在區塊標頭推算的時間；空位也有時間，因此對已對時的資料單調遞增。
+// 未對時或標頭無效時回傳 0。
+static uint32_t historyIndexTime(int index) {
+    int committedCount = historyCount - historyStagedCount;
+    if (index >= committedCount) {
+        uint32_t t = historyStaging[index - committedCount].time;
+        return t >= MIN_VALID_EPOCH ? t : 0;
+    }
+    int slot = (historyIndex - historyCount + index + MAX_HISTORY) % MAX_HISTORY;
+    HistoryBlockHeader hdr;
+    if (!historyStore->read(slot / HISTORY_RECORDS_PER_BLOCK, 0, (uint8_t*)&hdr, sizeof(hdr))) return 0;
+    return blockRecordTime(hdr, slot % HISTORY_RECORDS_PER_BLOCK);
+}
+
+// index 之後下一個可能有不同時間基準的位置：已寫入的紀錄跳到下一個區塊開頭，暫存樣本逐筆
+static int nextHistoryTimeBase(int index) {
+    int committedCount = historyCount - historyStagedCount;
+    if (index >= committedCount) return index + 1;
+    int slot = (historyIndex - historyCount + index + MAX_HISTORY) % MAX_HISTORY;
+    return min(index + HISTORY_RECORDS_PER_BLOCK - slot % HISTORY_RECORDS_PER_BLOCK, committedCount);
+}
+
+// 找出第一筆時間晚於 since 的紀錄位置 (0 = 最舊，historyCount = 沒有更新的紀錄)。
+// 以二分搜尋讀取區塊標頭，約 log2(MAX_HISTORY) 次 16-byte 讀取，不需逐筆掃描。
+// 未對時的區塊沒有時間 (例如某次開機在對時前就斷電，之後不會再被修正)，可能夾在環中間：
+// 探測點落在這種區塊時往後找最近一個有時間的區塊，找不到就把它們算進結果。
+// 未對時的紀錄寧可多送也不漏送，因此結果是安全的下限。
+int findHistoryIndexAfter(uint32_t since) {
+    if (historyCount == 0) return 0;
+    if (!historyStore->open(false)) return 0;
+    int lo = 0, hi = historyCount;
+    int probes = 0;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int probe = mid;
+        uint32_t t = 0;
+        while (probe < hi) {
+            probes++;
+            t = historyIndexTime(probe);
+            if (t != 0) break;
+            probe = nextHistoryTimeBase(probe);
+        }
+        if (t == 0) hi = mid;              // [mid, hi) 都沒有時間：全部保留
+        else if (t > since) hi = mid;      // mid 與 probe 之間未對時的紀錄也保留
+        else lo = probe + 1;               // 寫在 probe 之前的紀錄都比它舊
     }
+    historyStore->close();
+    Serial.printf("DEBUG: History index after %lu is %d/%d (%d probes).\n", (unsigned long)since, lo, historyCount, probes);
+    return lo;
 }
 
 void loadHistoryWindow(int offset) {
-    Serial.printf("DEBUG: loadHistoryWindow with offset %d\n", offset);
-    int points = min(historyCount, HISTORY_WINDOW_SIZE); 
-    if (points == 0) {
-        Serial.println("DEBUG: No history points to load.");
-        return;
+    int points = min(historyCount, HISTORY_WINDOW_SIZE);
+    if (points == 0) return;
+    offset = constrain(offset, 0, historyCount - points);
+    uint32_t oldestSeq = historyHeadSeq - historyCount;
+    uint32_t firstSeq = historyHeadSeq - offset - points;
+    if (historyWindowPoints == points && historyWindowFirstSeq == firstSeq) return;
+
+    int shift = (int)(firstSeq - historyWindowFirstSeq);
+    if (historyWindowPoints != points || abs(shift) >= points) {
+        Serial.printf("DEBUG: loadHistoryWindow reloading %d points at offset %d\n", points, offset);
+        historyWindowPoints = readHistoryRange(firstSeq - oldestSeq, points, historyWindowBuffer);
+    } else if (shift > 0) {
+        // 往新的方向捲動：保留重疊部分，尾端補讀 shift 筆
+        memmove(&historyWindowBuffer[0], &historyWindowBuffer[shift], (points - shift) * sizeof(DataPoint));
+        readHistoryRange(firstSeq + points - shift - oldestSeq, shift, &historyWindowBuffer[points - shift]);
+    } else {
+        // 往舊的方向捲動：保留重疊部分，前端補讀 -shift 筆
+        memmove(&historyWindowBuffer[-shift], &historyWindowBuffer[0], (points + shift) * sizeof(DataPoint));
+        readHistoryRange(firstSeq - oldestSeq, -shift, &historyWindowBuffer[0]);
     }
-    File file = SPIFFS.open("/history.dat", "r"); 
-    if (!file) {
-        Serial.println("DEBUG: Failed to open /history.dat for reading.");
-        return;
+    historyWindowFirstSeq = firstSeq;
+}
+
+// 圖表彙總視窗：只在層級、時間位置或彙總內容改變時重新讀取。回傳是否有可用時間。
+bool loadRollupWindow(RollupTier tier, int offset) {
+    static int cachedTier = -1;
+    static uint32_t cachedEnd = 0;
+    static uint32_t cachedGeneration = 0;
+    time_t now = time(nullptr);
+    if (now < MIN_VALID_EPOCH) return false;
+    offset = constrain(offset, 0, ROLLUP_SLOTS[tier] - HISTORY_WINDOW_SIZE);
+    uint32_t end = rollupBucketStart(tier, now) - offset * ROLLUP_PERIODS[tier];
+    if (cachedTier == tier && cachedEnd == end) {
+        if (cachedGeneration != rollupGeneration) {
+            // end 不變時只有開啟中的 bucket 會改變 (bucket 結束時 end 也跟著變而整段重讀)：
+            // 每次取樣只更新最右一格，不重新開檔讀取
+            RollupBucket& last = rollupWindowBuffer[HISTORY_WINDOW_SIZE - 1];
+            if (rollupOpen[tier].bucket.count > 0 && rollupOpen[tier].bucket.start == last.start) last = finishRollupBucket(rollupOpen[tier]);
+            cachedGeneration = rollupGeneration;
+        }
+        return true;
+    }
+    readRollupRange(tier, end, HISTORY_WINDOW_SIZE, rollupWindowBuffer);
+    cachedTier = tier;
+    cachedEnd = end;
+    cachedGeneration = rollupGeneration;
+    return true;
+}
+
+// ==================== 縮放圖表 ====================
+// 原始紀錄以 min/max 縮減成 CHART_COLUMNS 欄：每欄記下落在該欄的所有樣本的最小與最大值，
+// 畫成一條直線，單一樣本的尖峰在任何縮放層級都看得到 (平均或抽樣會把它抹掉)。
+// 欄以樣本序號對齊 (欄 = 序號 / 每欄樣本數)，新樣本只會加進最右一欄或開新欄，不必重新掃描。
+// 切換層級或捲動超出快取時從最新往最舊分段掃描，每次最多 CHART_SCAN_RECORDS_PER_FRAME 筆，
+// 最新的部分先出現，其餘在接下來幾次重畫補齊；掃描直接解讀區塊中的紀錄，不經過 DataPoint 暫存。
+static const int ZOOM_SAMPLES_PER_COLUMN[] = {
+    2,                                                  // CHART_ZOOM_2H:  30 秒一筆時約 1.8 小時
+    7,                                                  // CHART_ZOOM_6H:  約 6.3 小時
+    27,                                                 // CHART_ZOOM_24H: 約 24.3 小時
+    (MAX_HISTORY + CHART_COLUMNS - 1) / CHART_COLUMNS,  // CHART_ZOOM_ALL: 整個環形緩衝區
+};
+static int zoomSamplesPerColumn = 0;    // 快取的層級，0 = 無效
+static uint32_t zoomLastColumn = 0;     // chartColumnBuffer 最右一欄的欄號 (序號 / 每欄樣本數)
+static uint32_t zoomScannedFrom = 0;    // 已掃描的序號範圍 [from, to)
+static uint32_t zoomScannedTo = 0;
+
+int historyZoomSamplesPerColumn(ChartResolution zoom) {
+    return ZOOM_SAMPLES_PER_COLUMN[zoom - CHART_ZOOM_2H];
+}
+
+// 可往過去捲動的欄數
+static int zoomMaxOffset(int spp) {
+    if (historyCount == 0) return 0;
+    int columns = (historyHeadSeq - 1) / spp - (historyHeadSeq - historyCount) / spp + 1;
+    return max(0, columns - CHART_COLUMNS);
+}
+
+static void addToChartColumn(ChartColumn& c, const DataPoint& dp) {
+    if (isnan(dp.temp)) return; // 空位
+    int16_t t = lroundf(dp.temp * 100);
+    int16_t h = lroundf(dp.hum * 100);
+    int16_t r = dp.rssi;
+    if (c.count == 0) {
+        c.tempMin = c.tempMax = t;
+        c.humMin = c.humMax = h;
+        c.rssiMin = c.rssiMax = r;
+    } else {
+        c.tempMin = min(c.tempMin, t); c.tempMax = max(c.tempMax, t);
+        c.humMin = min(c.humMin, h); c.humMax = max(c.humMax, h);
+        c.rssiMin = min(c.rssiMin, r); c.rssiMax = max(c.rssiMax, r);
+    }
+    if (c.count < 0xFFFF) c.count++;
+}
+
+// 把序號 [firstSeq, endSeq) 的紀錄加進對應的欄；已提交的部分每個區塊一次連續讀取
+static void scanHistoryColumns(uint32_t firstSeq, uint32_t endSeq) {
+    uint32_t oldestSeq = historyHeadSeq - historyCount;
+    int32_t firstColumn = (int32_t)zoomLastColumn - (CHART_COLUMNS - 1);
+    int first = firstSeq - oldestSeq;
+    int count = endSeq - firstSeq;
+    int committedCount = historyCount - historyStagedCount;
+    int fromFile = max(0, min(count, committedCount - first));
+    DataPoint dp;
+    if (fromFile > 0 && historyStore->open(false)) {
+        uint8_t buf[HISTORY_BLOCK_SIZE];
+        int slot = (historyIndex - historyCount + first + MAX_HISTORY) % MAX_HISTORY;
+        uint32_t seq = firstSeq;
+        for (int done = 0; done < fromFile; ) {
+            int slotInBlock = slot % HISTORY_RECORDS_PER_BLOCK;
+            int run = min(fromFile - done, HISTORY_RECORDS_PER_BLOCK - slotInBlock);
+            historyStore->read(slot / HISTORY_RECORDS_PER_BLOCK, HISTORY_BLOCK_HEADER_SIZE + slotInBlock * HISTORY_RECORD_SIZE, buf, run * HISTORY_RECORD_SIZE);
+            for (int i = 0; i < run; i++, seq++) {
+                unpackDataPoint(buf + i * HISTORY_RECORD_SIZE, dp);
+                addToChartColumn(chartColumnBuffer[(int32_t)(seq / zoomSamplesPerColumn) - firstColumn], dp);
+            }
+            done += run;
+            slot = (slot + run) % MAX_HISTORY;
+        }
+        historyStore->close();
     }
-    int startIdx = (historyIndex - offset - points + MAX_HISTORY) % MAX_HISTORY;
-    Serial.printf("DEBUG: Loading %d points starting from index %d\n", points, startIdx);
-    for (int i = 0; i < points; i++) {
-        int idx = (startIdx + i) % MAX_HISTORY;
-        file.seek(idx * sizeof(DataPoint)); 
-        file.read((uint8_t*)&historyWindowBuffer[i], sizeof(DataPoint));
+    for (int i = fromFile; i < count; i++) {
+        uint32_t seq = firstSeq + i;
+        addToChartColumn(chartColumnBuffer[(int32_t)(seq / zoomSamplesPerColumn) - firstColumn], historyStaging[first + i - committedCount]);
+    }
+}
+
+// 畫面每次重畫呼叫；offset 以欄為單位 (0 = 最右一欄含最新樣本)。回傳 false 表示還在掃描，內容只有一部分
+bool loadHistoryColumns(ChartResolution zoom, int offset) {
+    int spp = historyZoomSamplesPerColumn(zoom);
+    if (historyCount == 0) {
+        memset(chartColumnBuffer, 0, sizeof(chartColumnBuffer));
+        zoomSamplesPerColumn = 0;
+        return true;
+    }
+    uint32_t oldestSeq = historyHeadSeq - historyCount;
+    uint32_t lastColumn = (historyHeadSeq - 1) / spp - constrain(offset, 0, zoomMaxOffset(spp));
+    int shift = (int)(lastColumn - zoomLastColumn);
+    if (spp != zoomSamplesPerColumn || abs(shift) >= CHART_COLUMNS) {
+        memset(chartColumnBuffer, 0, sizeof(chartColumnBuffer));
+        zoomSamplesPerColumn = spp;
+        zoomScannedFrom = zoomScannedTo = min(historyHeadSeq, (lastColumn + 1) * spp);
+    } else if (shift > 0) {
+        // 新樣本開了新欄或往新的方向捲動：已掃描的欄往左移
+        memmove(&chartColumnBuffer[0], &chartColumnBuffer[shift], (CHART_COLUMNS - shift) * sizeof(ChartColumn));
+        memset(&chartColumnBuffer[CHART_COLUMNS - shift], 0, shift * sizeof(ChartColumn));
+    } else if (shift < 0) {
+        memmove(&chartColumnBuffer[-shift], &chartColumnBuffer[0], (CHART_COLUMNS + shift) * sizeof(ChartColumn));
+        memset(&chartColumnBuffer[0], 0, -shift * sizeof(ChartColumn));
+    }
+    zoomLastColumn = lastColumn;
+    int32_t firstColumn = (int32_t)lastColumn - (CHART_COLUMNS - 1); // 開機初期可能為負 (左側留白)
+    uint32_t viewFirst = firstColumn > 0 ? max(oldestSeq, (uint32_t)firstColumn * spp) : oldestSeq;
+    uint32_t viewEnd = min(historyHeadSeq, (lastColumn + 1) * spp);
+    zoomScannedFrom = constrain(zoomScannedFrom, viewFirst, viewEnd);
+    zoomScannedTo = constrain(zoomScannedTo, zoomScannedFrom, viewEnd);
+    uint32_t budget = CHART_SCAN_RECORDS_PER_FRAME;
+    unsigned long start = millis();
+    if (zoomScannedTo < viewEnd) {
+        // 快取之後新增的樣本 (通常只有一筆)
+        uint32_t to = min(viewEnd, zoomScannedTo + budget);
+        scanHistoryColumns(zoomScannedTo, to);
+        budget -= to - zoomScannedTo;
+        zoomScannedTo = to;
+    }
+    if (zoomScannedFrom > viewFirst && budget > 0) {
+        uint32_t from = zoomScannedFrom - min(budget, zoomScannedFrom - viewFirst);
+        scanHistoryColumns(from, zoomScannedFrom);
+        zoomScannedFrom = from;
+        Serial.printf("DEBUG: loadHistoryColumns scanned down to seq %lu in %lu ms (%lu left)\n",
+                      (unsigned long)from, millis() - start, (unsigned long)(from - viewFirst));
+    }
+    return zoomScannedFrom == viewFirst && zoomScannedTo == viewEnd;
+}
+
+// 圖表可捲動的最大 offset (依目前解析度)
+int historyViewMaxOffset() {
+    if (chartResolution == CHART_RAW) return max(0, historyCount - HISTORY_WINDOW_SIZE);
+    if (chartResolution < CHART_MINUTE) return zoomMaxOffset(historyZoomSamplesPerColumn(chartResolution));
+    return ROLLUP_SLOTS[chartResolution - CHART_MINUTE] - HISTORY_WINDOW_SIZE;
+}
+
+// 有新樣本 (或空位) 時讓正在檢視過去的圖表停在原處
+static void keepHistoryViewStill(uint32_t previousHeadSeq) {
+    if (historyViewOffset == 0 || chartResolution >= CHART_MINUTE) return;
+    if (chartResolution == CHART_RAW) {
+        historyViewOffset += historyHeadSeq - previousHeadSeq;
+    } else if (previousHeadSeq > 0) {
+        int spp = historyZoomSamplesPerColumn(chartResolution);
+        historyViewOffset += (historyHeadSeq - 1) / spp - (previousHeadSeq - 1) / spp;
+    }
+    historyViewOffset = min(historyViewOffset, historyViewMaxOffset());
+}
+
+// ==================== 設定值 (write-back 快取) ====================
+// 設定值只在開機時從 NVS 讀一次，之後一律讀 RAM 中的全域變數。
+// 修改時只標記 dirty，等 SETTINGS_COMMIT_DELAY_MS 內沒有新的修改再一次寫入 NVS；
+// 關機 (esp_restart) 與 OTA 開始前也會強制寫入。
+enum SettingsDirtyFlag : uint8_t {
+    SETTINGS_DIRTY_ENG_MODE = 0x01,
+    SETTINGS_DIRTY_ALARM    = 0x02,
+    SETTINGS_DIRTY_WIFI     = 0x04,
+};
+static uint8_t settingsDirty = 0;
+static unsigned long settingsLastChange = 0;
+
+static void markSettingsDirty(uint8_t flag) {
+    settingsDirty |= flag;
+    settingsLastChange = millis(); // 連續修改會延後寫入，合併成一次 commit
+}
+
+void setEngineeringMode(bool enabled) {
+    if (isEngineeringMode == enabled) return;
+    isEngineeringMode = enabled;
+    markSettingsDirty(SETTINGS_DIRTY_ENG_MODE);
+}
+
+void setAlarm(uint8_t hour, uint8_t minute, bool enabled) {
+    if (alarmHour == hour && alarmMinute == minute && alarmEnabled == enabled) return;
+    alarmHour = hour;
+    alarmMinute = minute;
+    alarmEnabled = enabled;
+    markSettingsDirty(SETTINGS_DIRTY_ALARM);
+}
+
+void setWiFiCredentials(const String& ssid, const String& pass) {
+    if (wifiSSID == ssid && wifiPassword == pass) return;
+    wifiSSID = ssid;
+    wifiPassword = pass;
+    markSettingsDirty(SETTINGS_DIRTY_WIFI);
+}
+
+void flushSettings() {
+    if (settingsDirty == 0) return;
+    if (settingsDirty & (SETTINGS_DIRTY_ENG_MODE | SETTINGS_DIRTY_ALARM)) {
+        preferences.begin("medbox-meta", false);
+        if (settingsDirty & SETTINGS_DIRTY_ENG_MODE) {
+            preferences.putBool("engMode", isEngineeringMode);
+        }
+        if (settingsDirty & SETTINGS_DIRTY_ALARM) {
+            preferences.putUChar("alarmH", alarmHour);
+            preferences.putUChar("alarmM", alarmMinute);
+            preferences.putBool("alarmOn", alarmEnabled);
+        }
+        preferences.end();
+    }
+    if (settingsDirty & SETTINGS_DIRTY_WIFI) {
+        preferences.begin("wifi", false);
+        preferences.putString("ssid", wifiSSID);
+        preferences.putString("pass", wifiPassword);
+        preferences.end();
+    }
+    Serial.printf("DEBUG: Settings committed to NVS (dirty 0x%02X).\n", settingsDirty);
+    settingsDirty = 0;
+}
+
+void handleSettingsCommit() {
+    if (settingsDirty != 0 && millis() - settingsLastChange >= SETTINGS_COMMIT_DELAY_MS) {
+        flushSettings();
     }
-    file.close();
-    Serial.println("DEBUG: History window loaded.");
 }
 
 void loadPersistentStates() {
@@ -86,14 +1046,19 @@ void loadPersistentStates() {
     alarmHour = preferences.getUChar("alarmH", 0);
     alarmMinute = preferences.getUChar("alarmM", 0);
     alarmEnabled = preferences.getBool("alarmOn", false);
-    float savedTemp = preferences.getFloat("last_temp", 0.0);
-    float savedHum = preferences.getFloat("last_hum", 0.0);
-    Serial.printf("DEBUG: Loaded persistent states - EngMode: %d, Alarm: %02d:%02d (%d)\n", isEngineeringMode, alarmHour, alarmMinute, alarmEnabled);
-    if (savedTemp != 0.0 || savedHum != 0.0) {
-        cachedTemp = savedTemp;
-        cachedHum = savedHum;
+    preferences.end();
+    preferences.begin("wifi", true);
+    wifiSSID = preferences.getString("ssid", default_ssid);
+    wifiPassword = preferences.getString("pass", default_password);
+    preferences.end();
+    settingsDirty = 0;
+    Serial.printf("DEBUG: Loaded persistent states - EngMode: %d, Alarm: %02d:%02d (%d), SSID: %s\n", isEngineeringMode, alarmHour, alarmMinute, alarmEnabled, wifiSSID.c_str());
+    // 最後一次的感測值直接取自最新的歷史紀錄 (需先呼叫 loadHistoryMetadata)
+    DataPoint last;
+    if (historyCount > 0 && readHistoryRange(historyCount - 1, 1, &last) == 1 && !isnan(last.temp)) {
+        cachedTemp = last.temp;
+        cachedHum = last.hum;
         sensorDataValid = true;
         Serial.printf("Restored last sensor data: T=%.1f, H=%.1f\n", cachedTemp, cachedHum);
     }
-    preferences.end();
 }
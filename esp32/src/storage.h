@@ -4,5 +4,22 @@
 void initializeHistoryFile();
 void loadHistoryMetadata();
 void addDataToHistory(float temp, float hum, int16_t rssi);
+void flushHistory();
+void handleHistoryCommit();
+int readHistoryRange(int first, int count, DataPoint* out);
+int findHistoryIndexAfter(uint32_t since);
 void loadHistoryWindow(int offset);
+void initializeRollupFiles();
+uint32_t rollupPeriod(RollupTier tier);
+int rollupCapacity(RollupTier tier);
+int readRollupRange(RollupTier tier, uint32_t endTime, int count, RollupBucket* out);
+bool loadRollupWindow(RollupTier tier, int offset);
+bool loadHistoryColumns(ChartResolution zoom, int offset);
+int historyZoomSamplesPerColumn(ChartResolution zoom);
+int historyViewMaxOffset();
 void loadPersistentStates();
+void setEngineeringMode(bool enabled);
+void setAlarm(uint8_t hour, uint8_t minute, bool enabled);
+void setWiFiCredentials(const String& ssid, const String& pass);
+void flushSettings();
+void handleSettingsCommit();
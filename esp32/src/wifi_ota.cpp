@@ -8,23 +8,21 @@
 #include <BLEDevice.h> // <--- Added this include
 
 // Pre-declare functions from other modules that are used here
-void drawOtaScreen(String text, int progress = -1);
+void drawOtaScreen(const char* text, int progress = -1);
 void updateScreens();
+void flushHistory();
+void flushSettings();
 
 void startWiFiConnection() {
     Serial.println("DEBUG: startWiFiConnection");
     if (wifiState == WIFI_CONNECTING) return;
     wifiState = WIFI_CONNECTING;
     wifiConnectionStartTime = millis();
-    preferences.begin("wifi", true);
-    String savedSSID = preferences.getString("ssid", default_ssid);
-    String savedPASS = preferences.getString("pass", default_password);
-    preferences.end();
-    Serial.printf("DEBUG: Saved SSID from preferences: %s\n", savedSSID.c_str());
+    Serial.printf("DEBUG: Saved SSID from settings: %s\n", wifiSSID.c_str());
     WiFi.disconnect(true);
     delay(100);
     Serial.println("DEBUG: Attempting to connect to WiFi...");
-    WiFi.begin(savedSSID.c_str(), savedPASS.c_str());
+    WiFi.begin(wifiSSID.c_str(), wifiPassword.c_str());
     Serial.println("Starting WiFi connection...");
 }
 
@@ -104,17 +102,19 @@ void setupOTA() {
     ArduinoOTA.setHostname("smartmedbox");
     ArduinoOTA.setPassword("medbox123");
     ArduinoOTA
-        .onStart( [] { SPIFFS.end(); String type = (ArduinoOTA.getCommand() == U_FLASH) ? "sketch" : "filesystem"; drawOtaScreen("Updating " + type, 0); })
+        .onStart( [] { flushHistory(); flushSettings(); DATA_FS.end(); drawOtaScreen(ArduinoOTA.getCommand() == U_FLASH ? "Updating sketch" : "Updating filesystem", 0); })
         .onProgress([](unsigned int progress, unsigned int total) { drawOtaScreen("Updating...", (progress / (total / 100))); })
         .onEnd( [] { drawOtaScreen("Complete!", 100); delay(1000); ESP.restart(); })
         .onError([](ota_error_t error) {
-            String msg;
+            const char* msg = "";
             if (error == OTA_AUTH_ERROR) msg = "Auth Failed";
             else if (error == OTA_BEGIN_ERROR) msg = "Begin Failed";
             else if (error == OTA_CONNECT_ERROR) msg = "Connect Failed";
             else if (error == OTA_RECEIVE_ERROR) msg = "Receive Failed";
             else if (error == OTA_END_ERROR) msg = "End Failed";
-            drawOtaScreen("Error: " + msg, -1);
+            char text[32];
+            snprintf(text, sizeof(text), "Error: %s", msg);
+            drawOtaScreen(text, -1);
             delay(3000);
             ESP.restart();
         });
@@ -130,7 +130,7 @@ void enterOtaMode() {
         u8g2.clearBuffer();
         u8g2.setFont(u8g2_font_ncenB08_tr);
         u8g2.drawStr((128 - u8g2.getStrWidth("Need WiFi for OTA")) / 2, 38, "Need WiFi for OTA");
-        u8g2.sendBuffer();
+        sendDisplayFrame();
         delay(2000);
         currentUIMode = UI_MODE_MAIN_SCREENS;
         updateScreens();
@@ -150,6 +150,6 @@ void enterOtaMode() {
     u8g2.drawStr(0, 28, "smartmedbox.local");
     u8g2.drawStr(0, 42, ("IP: " + ip).c_str());
     u8g2.drawStr(0, 56, "Press BACK to exit");
-    u8g2.sendBuffer();
+    sendDisplayFrame();
     Serial.println("DEBUG: Displaying OTA information screen.");
 }
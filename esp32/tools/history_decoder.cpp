@@ -0,0 +1,95 @@
+// 壓縮歷史紀錄區塊 (0x95) 的參考解碼器，格式見 esp32/src/history_codec.h。
+// 不依賴 Arduino，可直接移植到 App 端 (Kotlin 只需把 uint8_t 當 0xFF 遮罩後的 Int 處理)。
+//
+// 編譯: g++ -std=c++11 -O2 -o history_decoder history_decoder.cpp
+// 用法: 每行一個封包的 hex (可含空白)，例如從 nRF Connect 複製的 notify 內容
+//       ./history_decoder < packets.txt > history.csv
+// 輸出: time,temp,hum (溫度 °C、濕度 %)；區塊序號不連續時在 stderr 提示遺失。
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct HistoryPoint {
+    uint32_t time;
+    float temp;
+    float hum;
+};
+
+static bool readVarint(const uint8_t* data, size_t length, size_t& pos, int32_t& value) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (pos >= length) return false;
+        uint8_t b = data[pos++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1); // zigzag
+            return true;
+        }
+    }
+    return false;
+}
+
+// 解碼一個 0x95 封包；格式錯誤時回傳 false (out 保留已解出的部分)
+bool decodeHistoryBlock(const uint8_t* data, size_t length, uint8_t& seq, std::vector<HistoryPoint>& out) {
+    if (length < 10 || data[0] != 0x95) return false;
+    seq = data[1];
+    uint32_t time = data[2] | (data[3] << 8) | (data[4] << 16) | ((uint32_t)data[5] << 24);
+    uint8_t interval = data[6];
+    int32_t temp = (int16_t)(data[7] | (data[8] << 8)); // 0.1°C
+    int32_t hum = data[9];
+    out.push_back({time, temp / 10.0f, (float)hum});
+    size_t pos = 10;
+    while (pos < length) {
+        uint8_t token = data[pos++];
+        if (!(token & 0x80)) {
+            // run：n+1 筆與前一筆相同
+            for (int i = 0; i <= token; i++) {
+                time += interval;
+                out.push_back({time, temp / 10.0f, (float)hum});
+            }
+            continue;
+        }
+        if (token & 0x78) return false; // 保留位元
+        int32_t delta = 0;
+        uint32_t step = interval;
+        if (token & 0x04) { if (!readVarint(data, length, pos, delta)) return false; step += delta; }
+        if (token & 0x02) { if (!readVarint(data, length, pos, delta)) return false; temp += delta; }
+        if (token & 0x01) { if (!readVarint(data, length, pos, delta)) return false; hum += delta; }
+        time += step;
+        out.push_back({time, temp / 10.0f, (float)hum});
+    }
+    return true;
+}
+
+int main() {
+    char line[4096];
+    int expectedSeq = -1;
+    unsigned long packets = 0, bytes = 0, points = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        std::vector<uint8_t> packet;
+        std::string hex;
+        for (char* p = line; *p; p++) {
+            if (isxdigit((unsigned char)*p)) hex += *p;
+        }
+        for (size_t i = 0; i + 1 < hex.size(); i += 2) packet.push_back((uint8_t)strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+        if (packet.empty()) continue;
+        std::vector<HistoryPoint> decoded;
+        uint8_t seq = 0;
+        if (!decodeHistoryBlock(packet.data(), packet.size(), seq, decoded)) {
+            fprintf(stderr, "packet %lu: malformed block\n", packets);
+        }
+        if (expectedSeq >= 0 && seq != expectedSeq) fprintf(stderr, "block %u: %d block(s) missing\n", seq, (uint8_t)(seq - expectedSeq));
+        expectedSeq = (uint8_t)(seq + 1);
+        for (const HistoryPoint& p : decoded) printf("%lu,%.1f,%.0f\n", (unsigned long)p.time, p.temp, p.hum);
+        packets++;
+        bytes += packet.size();
+        points += decoded.size();
+    }
+    fprintf(stderr, "%lu points in %lu packets, %.2f bytes/point\n", points, packets, points ? (double)bytes / points : 0.0);
+    return 0;
+}
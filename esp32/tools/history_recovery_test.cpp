@@ -0,0 +1,135 @@
+// 歷史區塊環寫入位置還原 (esp32/src/history_recovery.cpp) 的斷電測試，在主機上執行。
+// 模擬一連串的區塊寫入 (依序寫滿、提交到一半的區塊重寫、重新開機後從新區塊開始、多次繞回)，
+// 對每一個寫入前綴還原一次；再把下一次寫入當作寫到一半就斷電 (該區塊無效) 重複一次。
+// 還原結果與逐一掃描所有區塊得到的答案比對：最新區塊、筆數、寫入位置與下一個 seq。
+//
+// 編譯: g++ -std=c++11 -O2 -Wall -Wextra -I../src -o history_recovery_test history_recovery_test.cpp ../src/history_recovery.cpp
+// 執行: ./history_recovery_test  (全部通過時回傳 0)
+
+#include "history_recovery.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+struct SimBlock {
+    uint32_t seq;       // 0 = 從未寫入或寫到一半 (CRC 不符)
+    uint16_t count;
+};
+
+struct BlockWrite {
+    int block;
+    uint32_t seq;
+    uint16_t count;
+};
+
+struct SimFlash {
+    std::vector<SimBlock> blocks;
+    int reads;
+};
+
+static uint32_t probeSimBlock(void* ctx, int block, uint16_t& count) {
+    SimFlash& flash = *(SimFlash*)ctx;
+    flash.reads++;
+    count = flash.blocks[block].count;
+    return flash.blocks[block].seq;
+}
+
+static uint32_t lcg = 12345;
+static int randomInt(int n) {
+    lcg = lcg * 1103515245 + 12345;
+    return (lcg >> 16) % n;
+}
+
+// 依韌體的寫入方式產生區塊寫入序列：每次提交 1..recordsPerBlock 筆，區塊放不下或重新開機時開新區塊
+static std::vector<BlockWrite> makeWrites(int blockCount, int recordsPerBlock, int laps) {
+    std::vector<BlockWrite> writes;
+    int block = -1;
+    uint32_t seq = 0;
+    int count = 0;
+    while ((int)seq < blockCount * laps) {
+        int records = 1 + randomInt(recordsPerBlock);
+        bool reboot = randomInt(8) == 0;
+        if (block < 0 || reboot || count == recordsPerBlock) {
+            block = (block + 1) % blockCount;
+            seq++;
+            count = 0;
+        }
+        count = count + records > recordsPerBlock ? recordsPerBlock : count + records;
+        BlockWrite w = {block, seq, (uint16_t)count};
+        writes.push_back(w);
+    }
+    return writes;
+}
+
+// 逐一掃描所有區塊的答案：seq 最大的有效區塊是最新區塊，往後找到的第一個有效區塊是最舊區塊
+static HistoryHead scanHistoryHead(const SimFlash& flash, int recordsPerBlock) {
+    const int N = flash.blocks.size();
+    HistoryHead expect = {-1, 0, 0, 0, 0};
+    for (int b = 0; b < N; b++) {
+        if (flash.blocks[b].seq > expect.headSeq) {
+            expect.head = b;
+            expect.headSeq = flash.blocks[b].seq;
+        }
+    }
+    if (expect.head < 0) return expect;
+    int headCount = flash.blocks[expect.head].count;
+    int oldest = (expect.head + 1) % N;
+    while (flash.blocks[oldest].seq == 0) oldest = (oldest + 1) % N;
+    int span = (expect.head - oldest + N) % N + 1;
+    expect.count = (span - 1) * recordsPerBlock + headCount;
+    expect.index = (expect.head * recordsPerBlock + headCount) % (N * recordsPerBlock);
+    return expect;
+}
+
+static int runCase(int blockCount, int recordsPerBlock, int laps) {
+    std::vector<BlockWrite> writes = makeWrites(blockCount, recordsPerBlock, laps);
+    int failures = 0;
+    int maxReads = 0;
+    for (size_t prefix = 0; prefix <= writes.size(); prefix++) {
+        for (int torn = 0; torn <= 1; torn++) {
+            if (torn && prefix == writes.size()) continue;
+            SimFlash flash;
+            flash.blocks.assign(blockCount, SimBlock());
+            for (size_t i = 0; i < prefix; i++) {
+                SimBlock b = {writes[i].seq, writes[i].count};
+                flash.blocks[writes[i].block] = b;
+            }
+            if (torn) flash.blocks[writes[prefix].block] = SimBlock();
+            flash.reads = 0;
+
+            HistoryHead got = recoverHistoryHead(blockCount, recordsPerBlock, probeSimBlock, &flash);
+            HistoryHead expect = scanHistoryHead(flash, recordsPerBlock);
+            bool ok = got.head == expect.head && got.headSeq == expect.headSeq && got.count == expect.count && got.index == expect.index;
+            // 沒有斷在寫入途中時，最後一次寫入的內容必須完整還原
+            if (ok && !torn && prefix > 0) {
+                const BlockWrite& last = writes[prefix - 1];
+                ok = got.head == last.block && got.headSeq == last.seq;
+            }
+            // 下一個區塊的 seq (historyNextBlockSeq = headSeq + 1) 必須大於環中所有區塊
+            for (int b = 0; ok && b < blockCount; b++) {
+                if (flash.blocks[b].seq >= got.headSeq + 1) ok = false;
+            }
+            if (got.reads != flash.reads) ok = false;
+            if (!ok) {
+                if (failures < 10) {
+                    printf("FAIL N=%d R=%d prefix %zu%s: got head %d seq %u count %d index %d, expected head %d seq %u count %d index %d\n",
+                           blockCount, recordsPerBlock, prefix, torn ? " torn" : "", got.head, got.headSeq, got.count, got.index,
+                           expect.head, expect.headSeq, expect.count, expect.index);
+                }
+                failures++;
+            }
+            if (got.reads > maxReads) maxReads = got.reads;
+        }
+    }
+    printf("N=%d R=%d: %zu writes, %zu recoveries, max %d block reads, %d failures\n", blockCount, recordsPerBlock,
+           writes.size(), writes.size() * 2 + 1, maxReads, failures);
+    return failures;
+}
+
+int main() {
+    int failures = 0;
+    for (int n = 1; n <= 9; n++) failures += runCase(n, 4, 4);
+    failures += runCase(225, 80, 3); // 與 config.h 的 HISTORY_BLOCK_COUNT / HISTORY_RECORDS_PER_BLOCK 相同
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+// 原始分割區歷史紀錄後端 (esp32/src/history_partition_store.cpp) 的主機效能估算與斷電測試。
+// esp_partition_read/write/erase_range 以記憶體中的 NOR flash 模擬：寫入只能把 1 改成 0 (違反即算失敗)，
+// 抹除以 4KB sector 為單位。每個操作依典型 SPI NOR 規格累計模擬時間，micros() 傳回該時間，
+// 因此後端自己的 HistoryStoreStats 就是模擬出的延遲。
+//  1. 效能：與 HISTORY_STORE_BENCHMARK 相同的寫入/讀取模式 (另加隨機區塊寫入)，在幾種分割區大小下輸出
+//     append / random read 延遲、開機重建時間、page 寫入、抹除與搬移次數，以及各 sector 抹除次數的最大/最小值。
+//  2. 斷電：對寫入序列中的每一個寫入/抹除操作各跑一次，在該操作做到一半時斷電 (寫入只完成前半、抹除只完成一半)。
+//     重新開機後每個區塊都必須是最後一次成功寫入的內容 (斷電時寫入中的區塊也可以是新內容)；
+//     再寫滿分割區一圈，確認回收 (relocateAfterHead) 沒有遺失區塊，最後再開機一次比對。
+// SPIFFS / LittleFS 的內部配置不在這裡模擬，檔案系統後端仍以裝置上的 HISTORY_STORE_BENCHMARK 比較。
+//
+// 編譯: g++ -std=c++11 -O2 -Wall -Wextra -Ihost -I../src -o history_store_bench history_store_bench.cpp ../src/history_partition_store.cpp
+// 執行: ./history_store_bench [-v]  (全部通過時回傳 0；-v 顯示韌體的 DEBUG 訊息)
+
+#include "config.h"
+#include "history_store.h"
+#include <stdio.h>
+#include <vector>
+
+// 典型 SPI NOR 時間 (GD25Q / W25Q 系列規格書的 typical 值)，換用其他 flash 時調整
+static const unsigned long FLASH_ERASE_US = 45000;        // 4KB sector 抹除
+static const unsigned long FLASH_PROGRAM_SETUP_US = 20;   // 每次寫入的固定開銷
+static const unsigned long FLASH_PROGRAM_NS_PER_BYTE = 2700; // 256B page 約 0.7 ms
+static const unsigned long FLASH_READ_SETUP_US = 5;
+static const unsigned long FLASH_READ_BYTES_PER_US = 20;  // 80 MHz DIO
+static const int FLASH_SECTOR_SIZE = 4096;
+
+HostSerial Serial;
+
+struct SimFlash {
+    esp_partition_t part;
+    std::vector<uint8_t> image;
+    std::vector<uint32_t> sectorErases;
+    unsigned long clock;    // 模擬時間 (us)
+    long ops;               // 已執行的寫入/抹除操作
+    long powerLossAt;       // 第幾個寫入/抹除操作做到一半時斷電，< 0 = 不斷電
+    bool powerLost;
+    int tornErases;
+    int violations;         // 寫入未抹除的 bit 或未對齊的抹除
+};
+static SimFlash flash;
+
+unsigned long micros() { return flash.clock; }
+
+static void resetFlash(int sectors) {
+    flash.part = esp_partition_t();
+    flash.part.type = ESP_PARTITION_TYPE_DATA;
+    flash.part.subtype = ESP_PARTITION_SUBTYPE_ANY;
+    flash.part.size = sectors * FLASH_SECTOR_SIZE;
+    flash.image.assign(flash.part.size, 0xFF);
+    flash.sectorErases.assign(sectors, 0);
+    flash.clock = 0;
+    flash.ops = 0;
+    flash.powerLossAt = -1;
+    flash.powerLost = false;
+    flash.tornErases = 0;
+    flash.violations = 0;
+}
+
+// 模擬重新上電：之後的操作正常執行
+static void restorePower() {
+    flash.powerLost = false;
+    flash.powerLossAt = -1;
+}
+
+// 回傳 true 表示這個操作做到一半就斷電
+static bool tearThisOp() {
+    return flash.ops++ == flash.powerLossAt;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t, esp_partition_subtype_t, const char*) {
+    return &flash.part;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t*, size_t src_offset, void* dst, size_t size) {
+    if (flash.powerLost || src_offset + size > flash.image.size()) return ESP_FAIL;
+    memcpy(dst, &flash.image[src_offset], size);
+    flash.clock += FLASH_READ_SETUP_US + size / FLASH_READ_BYTES_PER_US;
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t*, size_t dst_offset, const void* src, size_t size) {
+    if (flash.powerLost || dst_offset + size > flash.image.size()) return ESP_FAIL;
+    bool torn = tearThisOp();
+    size_t n = torn ? size / 2 : size;
+    const uint8_t* bytes = (const uint8_t*)src;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t& cell = flash.image[dst_offset + i];
+        if (bytes[i] & ~cell) flash.violations++;
+        cell &= bytes[i];
+    }
+    flash.clock += FLASH_PROGRAM_SETUP_US + size * FLASH_PROGRAM_NS_PER_BYTE / 1000;
+    if (torn) flash.powerLost = true;
+    return torn ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t*, size_t offset, size_t size) {
+    if (flash.powerLost || offset + size > flash.image.size()) return ESP_FAIL;
+    if (offset % FLASH_SECTOR_SIZE || size % FLASH_SECTOR_SIZE) {
+        flash.violations++;
+        return ESP_FAIL;
+    }
+    if (tearThisOp()) {
+        // 抹除中斷後的內容不確定：交替只抹掉前半 (摘要頁消失) 或後半 (摘要還在、資料頁已清空)
+        size_t half = FLASH_SECTOR_SIZE / 2;
+        size_t start = offset + (flash.tornErases++ % 2 ? 0 : half);
+        memset(&flash.image[start], 0xFF, half);
+        flash.powerLost = true;
+        return ESP_FAIL;
+    }
+    memset(&flash.image[offset], 0xFF, size);
+    for (size_t s = offset / FLASH_SECTOR_SIZE; s < (offset + size) / FLASH_SECTOR_SIZE; s++) flash.sectorErases[s]++;
+    flash.clock += FLASH_ERASE_US * (size / FLASH_SECTOR_SIZE);
+    return ESP_OK;
+}
+
+static uint32_t lcg = 12345;
+static int randomInt(int n) {
+    lcg = lcg * 1103515245 + 12345;
+    return (lcg >> 16) % n;
+}
+
+enum Workload { WORKLOAD_RING, WORKLOAD_RANDOM };
+static const char* workloadName(Workload w) { return w == WORKLOAD_RING ? "ring" : "random"; }
+
+// 第 i 次寫入的區塊與內容。ring：與韌體相同依序寫區塊環，每個區塊提交 4 次，紀錄只往後增加；
+// random：每次寫入隨機區塊，讓 sector 回收時仍有較多有效頁需要搬移
+static int makeWrite(Workload w, int i, uint8_t* page) {
+    const int commitsPerBlock = 4;
+    int block = w == WORKLOAD_RING ? (i / commitsPerBlock) % HISTORY_BLOCK_COUNT : randomInt(HISTORY_BLOCK_COUNT);
+    int records = w == WORKLOAD_RING ? (i % commitsPerBlock + 1) * HISTORY_RECORDS_PER_BLOCK / commitsPerBlock : HISTORY_RECORDS_PER_BLOCK;
+    memset(page, 0xFF, HISTORY_BLOCK_SIZE);
+    memcpy(page, &i, sizeof(i));    // 每次寫入的內容都不同，比對時才分得出新舊版本
+    page[4] = block;
+    for (int b = HISTORY_BLOCK_HEADER_SIZE; b < HISTORY_BLOCK_HEADER_SIZE + records * HISTORY_RECORD_SIZE; b++) page[b] = randomInt(256);
+    return block;
+}
+
+// ==================== 效能 ====================
+
+static void benchmark(int sectors, Workload workload) {
+    const int passes = 2;
+    const int writes = passes * HISTORY_BLOCK_COUNT * 4;
+    const int randomReads = 200;
+    uint8_t page[HISTORY_BLOCK_SIZE];
+    resetFlash(sectors);
+    lcg = 12345;
+    HistoryStoreStats w;
+    {
+        PartitionHistoryStore store("history");
+        store.begin();
+        for (int i = 0; i < writes; i++) {
+            int block = makeWrite(workload, i, page);
+            if (!store.writeBlock(block, page)) {
+                printf("BENCH: %d sectors %s: write %d failed\n", sectors, workloadName(workload), i);
+                return;
+            }
+        }
+        w = store.stats();
+    }
+    // 重新開機：量重建對應表的時間，再做與 readHistoryRange 相同的部分讀取
+    PartitionHistoryStore store("history");
+    unsigned long bootStart = micros();
+    store.begin();
+    unsigned long bootMicros = micros() - bootStart;
+    for (int i = 0; i < randomReads; i++) {
+        int slot = randomInt(HISTORY_RECORDS_PER_BLOCK);
+        store.read(randomInt(HISTORY_BLOCK_COUNT), 0, page, HISTORY_BLOCK_HEADER_SIZE + (slot + 1) * HISTORY_RECORD_SIZE);
+    }
+    const HistoryStoreStats& r = store.stats();
+    uint32_t minErases = flash.sectorErases[0], maxErases = 0;
+    for (int s = 0; s < sectors; s++) {
+        minErases = min(minErases, flash.sectorErases[s]);
+        maxErases = max(maxErases, flash.sectorErases[s]);
+    }
+    printf("BENCH: %2d sectors %-6s append avg %5lu us (max %6lu us), random read avg %lu us, boot %lu us, "
+           "%lu pages programmed, %lu erases (per sector %lu..%lu), %lu relocated pages\n",
+           sectors, workloadName(workload), (unsigned long)(w.writeMicros / w.writes), (unsigned long)w.maxWriteMicros,
+           (unsigned long)(r.readMicros / max(1u, r.reads)), bootMicros, (unsigned long)w.pagesProgrammed,
+           (unsigned long)w.erases, (unsigned long)minErases, (unsigned long)maxErases, (unsigned long)w.relocations);
+}
+
+// ==================== 斷電 ====================
+
+struct Model {
+    std::vector<std::vector<uint8_t>> blocks;   // 最後一次成功寫入的內容，從未寫入 = 全 0xFF
+    int pendingBlock;                           // 斷電時寫入中的區塊，-1 = 沒有
+    std::vector<uint8_t> pendingPage;
+};
+
+static int verifyStore(PartitionHistoryStore& store, Model& model) {
+    int mismatches = 0;
+    uint8_t page[HISTORY_BLOCK_SIZE];
+    for (int b = 0; b < HISTORY_BLOCK_COUNT; b++) {
+        if (!store.read(b, 0, page, sizeof(page))) {
+            mismatches++;
+            continue;
+        }
+        if (memcmp(page, model.blocks[b].data(), sizeof(page)) == 0) continue;
+        if (b == model.pendingBlock && memcmp(page, model.pendingPage.data(), sizeof(page)) == 0) {
+            model.blocks[b] = model.pendingPage;
+            continue;
+        }
+        mismatches++;
+    }
+    model.pendingBlock = -1;
+    return mismatches;
+}
+
+static bool writeAndRecord(PartitionHistoryStore& store, Model& model, int block, const uint8_t* page) {
+    if (!store.writeBlock(block, page)) {
+        model.pendingBlock = block;
+        model.pendingPage.assign(page, page + HISTORY_BLOCK_SIZE);
+        return false;
+    }
+    model.blocks[block].assign(page, page + HISTORY_BLOCK_SIZE);
+    return true;
+}
+
+static int runPowerLossCase(int sectors, Workload w, int writes) {
+    uint8_t page[HISTORY_BLOCK_SIZE];
+    // 不斷電跑一次，得到整個序列的寫入/抹除操作數
+    resetFlash(sectors);
+    lcg = 777;
+    {
+        PartitionHistoryStore store("history");
+        store.begin();
+        for (int i = 0; i < writes; i++) {
+            int block = makeWrite(w, i, page);
+            store.writeBlock(block, page);
+        }
+    }
+    long totalOps = flash.ops;
+    int failures = 0;
+    for (long lossAt = 0; lossAt < totalOps; lossAt++) {
+        resetFlash(sectors);
+        flash.powerLossAt = lossAt;
+        lcg = 777;
+        Model model;
+        model.blocks.assign(HISTORY_BLOCK_COUNT, std::vector<uint8_t>(HISTORY_BLOCK_SIZE, 0xFF));
+        model.pendingBlock = -1;
+        {
+            PartitionHistoryStore store("history");
+            if (store.begin()) {
+                for (int i = 0; i < writes; i++) {
+                    int block = makeWrite(w, i, page);
+                    if (!writeAndRecord(store, model, block, page)) break;
+                }
+            }
+        }
+        restorePower();
+        const char* stage = nullptr;
+        int mismatches = 0;
+        {
+            PartitionHistoryStore store("history");
+            if (!store.begin()) stage = "boot";
+            else if ((mismatches = verifyStore(store, model)) != 0) stage = "after power loss";
+            // 繼續寫滿一圈，每個 sector 都被回收過
+            for (int i = 0; !stage && i < sectors * 15; i++) {
+                int block = makeWrite(WORKLOAD_RANDOM, writes + i, page);
+                if (!writeAndRecord(store, model, block, page)) stage = "write after power loss";
+            }
+            if (!stage && (mismatches = verifyStore(store, model)) != 0) stage = "after recycling";
+        }
+        if (!stage) {
+            PartitionHistoryStore store("history");
+            if (!store.begin() || (mismatches = verifyStore(store, model)) != 0) stage = "second boot";
+        }
+        if (!stage && flash.violations) stage = "flash misuse";
+        if (stage) {
+            if (failures < 10) {
+                printf("FAIL %d sectors %s: power loss at op %ld/%ld: %s (%d blocks wrong, %d flash violations)\n",
+                       sectors, workloadName(w), lossAt, totalOps, stage, mismatches, flash.violations);
+            }
+            failures++;
+        }
+    }
+    printf("%d sectors %s: %d writes, %ld power-loss points, %d failures\n", sectors, workloadName(w), writes, totalOps, failures);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    Serial.verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    // 最小分割區：全部區塊 + head + head 之後的空 sector (見 PartitionHistoryStore::begin)
+    const int minSectors = (HISTORY_BLOCK_COUNT + 14) / 15 + 2;
+    const int sizes[] = {minSectors, 32, 64};
+    for (int sectors : sizes) {
+        benchmark(sectors, WORKLOAD_RING);
+        benchmark(sectors, WORKLOAD_RANDOM);
+    }
+    int failures = 0;
+    failures += runPowerLossCase(minSectors, WORKLOAD_RING, 1200);
+    failures += runPowerLossCase(minSectors, WORKLOAD_RANDOM, 600);
+    failures += runPowerLossCase(32, WORKLOAD_RANDOM, 600);
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
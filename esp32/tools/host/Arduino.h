@@ -0,0 +1,35 @@
+#pragma once
+
+// 主機編譯用的最小 Arduino.h：只提供 config.h 與 history_partition_store.cpp 用到的部分
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+#define U8X8_PROGMEM
+
+class String {};
+
+// 由測試程式定義 (例如傳回模擬的 flash 時間)
+unsigned long micros();
+
+struct HostSerial {
+    bool verbose = false;   // 預設不輸出韌體的 DEBUG 訊息
+    int printf(const char* format, ...) {
+        if (!verbose) return 0;
+        va_list args;
+        va_start(args, format);
+        int n = vprintf(format, args);
+        va_end(args);
+        return n;
+    }
+    void println(const char* s) {
+        if (verbose) puts(s);
+    }
+};
+extern HostSerial Serial;
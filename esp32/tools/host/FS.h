@@ -0,0 +1,8 @@
+#pragma once
+
+// 主機編譯用：只提供 history_store.h 宣告 FileHistoryStore 需要的型別，檔案後端不在主機上模擬
+namespace fs {
+class File {};
+class FS {};
+}
+using fs::File;